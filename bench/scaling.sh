@@ -0,0 +1,100 @@
+#!/bin/bash
+#
+# strong and weak scaling of the full simulation loop
+#
+# usage: scaling.sh path/to/mpcd [output.csv]
+#
+# Runs mpcd with fixed seeds and output disabled for every combination of the
+# parameters below and every thread count, then writes one CSV line per run
+# with the time per step, the peak memory and the parallel efficiency. All
+# parameters can be overridden from the environment, e.g.
+#
+#   SIZES="128 256" THREADS="1 2 4 8" ./scaling.sh build/mpcd
+#   ENGINES="reference sparse batched" ./scaling.sh build/mpcd
+#
+
+set -e
+
+if [ $# -lt 1 ]; then
+  echo "usage: $0 path/to/mpcd [output.csv]" >&2
+  exit 1
+fi
+
+mpcd=$(readlink -f "$1")
+output=${2:-/dev/stdout}
+
+# grid sizes (L x L) used for strong scaling, base size for weak scaling
+SIZES=${SIZES:-"64 128"}
+# densities (per type)
+DENSITIES=${DENSITIES:-"10 20"}
+# number of types
+NTYPES=${NTYPES:-"1 2 4"}
+# thread counts (default: powers of two up to the number of cores)
+if [ -z "$THREADS" ]; then
+  THREADS=1
+  for (( p=2; p<=$(nproc); p*=2 )); do THREADS="$THREADS $p"; done
+fi
+# number of time steps per run
+NSTEPS=${NSTEPS:-50}
+# collision engines
+ENGINES=${ENGINES:-"reference"}
+
+workdir=$(mktemp -d)
+trap 'rm -rf "$workdir"' EXIT
+
+# print a list of n identical values as [v, v, ...]
+repeat() {
+  local list=$2
+  for (( i=1; i<$1; i++ )); do list="$list, $2"; done
+  echo "[$list]"
+}
+
+# run a single configuration and print 'particles time_per_step peak_memory'
+run() {
+  local L=$1 dens=$2 ntypes=$3 threads=$4 engine=$5
+  cat > "$workdir/parameters" <<PARAMS
+L = [$L, $L]
+nsteps = $NSTEPS
+ninfo = $((NSTEPS+1))
+tau = 5e-2
+ntypes = $ntypes
+kappa = $(repeat $ntypes 1.8)
+dens = $(repeat $ntypes $dens)
+seed = 1
+engine = $engine
+PARAMS
+  "$mpcd" "$workdir" --threads "$threads" --no-output --verbose 0 > /dev/null
+  awk -F' = ' '/^particles/ { n=$2 }
+               /^time per step/ { t=$2 }
+               /^peak memory/ { m=$2 }
+               END { print n, t, m }' "$workdir/summary"
+}
+
+echo "engine,mode,L,dens,ntypes,threads,particles,time_per_step_ms,peak_memory_mb,efficiency" > "$output"
+
+for engine in $ENGINES; do
+  for ntypes in $NTYPES; do
+    for dens in $DENSITIES; do
+      for L in $SIZES; do
+        # strong scaling: fixed size, efficiency is t1/(p*tp)
+        t1=
+        for p in $THREADS; do
+          read n t m < <(run $L $dens $ntypes $p $engine)
+          [ -z "$t1" ] && t1=$(awk "BEGIN { print $t*$p }")
+          eff=$(awk "BEGIN { printf \"%.3f\", $t1/($p*$t) }")
+          echo "$engine,strong,$L,$dens,$ntypes,$p,$n,$t,$m,$eff" >> "$output"
+        done
+
+        # weak scaling: constant number of boxes per thread, efficiency is t1/tp
+        t1=
+        for p in $THREADS; do
+          Lp=$(awk "BEGIN { printf \"%d\", $L*sqrt($p)+.5 }")
+          read n t m < <(run $Lp $dens $ntypes $p $engine)
+          [ -z "$t1" ] && t1=$t
+          eff=$(awk "BEGIN { printf \"%.3f\", $t1/$t }")
+          echo "$engine,weak,$Lp,$dens,$ntypes,$p,$n,$t,$m,$eff" >> "$output"
+        done
+      done
+    done
+  done
+done
@@ -30,6 +30,16 @@ ntypes = int(load('ntypes', dat))
 nsteps = int(load('nsteps', dat))
 ninfo  = int(load('ninfo', dat))
 
+# shape of the species densities (the frames may be coarse-grained)
+shape = L
+try:
+    for line in open(outdir + '/frames'):
+        f = line.split()
+        if f and f[0]=='species':
+            shape = [int(f[6]), int(f[7])]
+except IOError:
+    pass
+
 cmap = 'viridis'
 if ntypes==3:
     cmap = 'jet'
@@ -44,14 +54,14 @@ def get_density(frame, t = -1):
     fn = '{0}/frame{1}.density{2}.dat'.format(outdir ,str(frame*ninfo), suffix)
     dat = open(fn, mode='rw').read()
     arr = np.array(struct.unpack('i'*(len(dat)//4), dat))
-    return arr.reshape((L[0], L[1]))
+    return arr.reshape((shape[0], shape[1]))
 
 def plot_frame(frame):
     fig.clf()
     plt.subplots_adjust(wspace=.5)
 
-    d = np.zeros(L)
-    h = np.zeros(L)
+    d = np.zeros(shape)
+    h = np.zeros(shape)
     for i in range(ntypes):
         dens = get_density(frame, t=i)
         d += dens
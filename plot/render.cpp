@@ -0,0 +1,563 @@
+//
+// rendering of the frames to images
+//
+// Reads the species densities of every frame of a run (in parallel over the
+// frames) and writes one image per frame with the same panels as plot.py:
+// the composition of the boxes on the left and the total density on the
+// right. The images can be assembled into a movie with e.g.
+//
+//    ffmpeg -framerate 10 -pattern_type glob -i 'images/*.png' movie.mp4
+//
+
+#include "header.hpp"
+#include "tools.hpp"
+#include "publish.hpp"
+#include <thread>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef MPCD_ZLIB
+#include <zlib.h>
+#endif
+
+using namespace std;
+namespace opt = boost::program_options;
+
+// =============================================================================
+// parameters
+
+// input directory
+string directory;
+// output directory of the images (default is directory/images)
+string outdir;
+// image format (png or ppm)
+string format = "png";
+// size of the boxes in pixels
+int scale = 1;
+// width of the space between the panels in pixels
+int gap = 8;
+// number of threads (0 is all available)
+int nthreads = 0;
+// shared memory object to follow instead of the frame files
+string shm;
+// seconds without a new frame after which the publisher is considered dead
+double timeout = 300;
+// verbosity level
+int verbose = 1;
+// digits of the time steps in the names of the images
+int digits = 9;
+
+// =============================================================================
+// frames
+
+// the species densities of a frame, in the order of the shared memory frames
+// (i.e. density[type][box] with the boxes in row major order)
+struct frame
+{
+  // time step of the frame
+  long time;
+  std::vector<int> density;
+};
+
+// the runs being rendered
+struct run
+{
+  int ntypes, nsteps, ninfo;
+  // number of boxes (or blocks) in each dimension of the species frames
+  int nx, ny;
+};
+
+// read the parameters of a run and the shape of its species frames
+run read_run(const string& dir)
+{
+  run r;
+  string Lget;
+  opt::options_description config;
+  config.add_options()
+    ("L", opt::value<string>(&Lget))
+    ("ntypes", opt::value<int>(&r.ntypes)->default_value(2))
+    ("nsteps", opt::value<int>(&r.nsteps)->default_value(100000))
+    ("ninfo", opt::value<int>(&r.ninfo)->default_value(100));
+
+  const string inputname = dir + "/parameters";
+  ifstream file(inputname);
+  if(not file.good())
+    throw inline_str("error while opening runcard file ", inputname);
+  opt::variables_map vm;
+  opt::store(opt::parse_config_file(file, config, true), vm);
+  opt::notify(vm);
+
+  const auto L = get_ints_from_string(Lget);
+  if(L.size()!=2) throw inline_str("wrong system size in ", inputname);
+  if(r.ntypes<1 or r.ninfo<1) throw inline_str("wrong number of types or ninfo in ", inputname);
+
+  // the frames may be coarse-grained (runs without a layout are not)
+  r.nx = L[0];
+  r.ny = L[1];
+  ifstream layout(dir + "/frames");
+  if(layout.good())
+  {
+    bool found = false;
+    for(string line; getline(layout, line);)
+    {
+      stringstream s(line);
+      string field;
+      int x0, y0, x1, y1, b;
+      if(s >> field and field=="species" and s >> x0 >> y0 >> x1 >> y1 >> b >> r.nx >> r.ny)
+        found = true;
+    }
+    if(not found)
+      throw inline_str("the species are not written in ", dir, " (see output in the runcard)");
+  }
+
+  return r;
+}
+
+// name of the file of a type in a frame
+string species_file(const string& dir, long time, int type)
+{
+  return inline_str(dir, "/frame", time, ".density.", type, ".dat");
+}
+
+// read the species densities of a frame from the frame files
+frame read_frame(const string& dir, const run& r, long time)
+{
+  const size_t nboxes = size_t(r.nx)*r.ny;
+  frame f { time, vector<int>(r.ntypes*nboxes) };
+
+  for(int s=0; s<r.ntypes; ++s)
+  {
+    const auto fname = species_file(dir, time, s);
+    ifstream file(fname, ios::in | ios::binary);
+    file.read(reinterpret_cast<char*>(&f.density[s*nboxes]), nboxes*sizeof(int));
+    if(size_t(file.gcount())!=nboxes*sizeof(int))
+      throw inline_str("unable to read file ", fname);
+  }
+
+  return f;
+}
+
+// =============================================================================
+// colors
+
+using color = std::array<unsigned char, 3>;
+
+// a color map sampled at 256 points
+struct color_map
+{
+  std::array<color, 256> table;
+
+  // from a function mapping [0, 1] to rgb in [0, 1]
+  template<class F>
+  color_map(F f)
+  {
+    for(int k=0; k<256; ++k)
+    {
+      const auto c = f(k/255.);
+      for(int i=0; i<3; ++i)
+        table[k][i] = (unsigned char)lround(255*max(0., min(1., c[i])));
+    }
+  }
+
+  // color of a value in [0, 1] (clamped)
+  const color& operator()(double x) const
+  { return table[max(0, min(255, int(255*x+.5)))]; }
+};
+
+// linear interpolation between the nodes (x, r, g, b) of a color map
+std::array<double, 3> interpolate(const vector<std::array<double, 4>>& nodes, double x)
+{
+  size_t k = 1;
+  while(k<nodes.size()-1 and nodes[k][0]<x) ++k;
+  const auto& a = nodes[k-1];
+  const auto& b = nodes[k];
+  const double t = (x-a[0])/(b[0]-a[0]);
+  return {{ a[1]+t*(b[1]-a[1]), a[2]+t*(b[2]-a[2]), a[3]+t*(b[3]-a[3]) }};
+}
+
+// matplotlib's viridis (sampled every 32 entries)
+std::array<double, 3> viridis(double x)
+{
+  static const vector<std::array<double, 4>> nodes = {
+    {{ 0.000, 0.267004, 0.004874, 0.329415 }},
+    {{ 0.125, 0.282623, 0.140926, 0.457517 }},
+    {{ 0.250, 0.253935, 0.265254, 0.529983 }},
+    {{ 0.375, 0.206756, 0.371758, 0.553117 }},
+    {{ 0.500, 0.163625, 0.471133, 0.558148 }},
+    {{ 0.625, 0.127568, 0.566949, 0.550556 }},
+    {{ 0.750, 0.134692, 0.658636, 0.517649 }},
+    {{ 0.875, 0.266941, 0.748751, 0.440573 }},
+    {{ 1.000, 0.993248, 0.906157, 0.143936 }}
+  };
+  return interpolate(nodes, x);
+}
+
+// matplotlib's jet
+std::array<double, 3> jet(double x)
+{
+  const auto channel = [x](const vector<std::array<double, 2>>& nodes) {
+    size_t k = 1;
+    while(k<nodes.size()-1 and nodes[k][0]<x) ++k;
+    const double t = (x-nodes[k-1][0])/(nodes[k][0]-nodes[k-1][0]);
+    return nodes[k-1][1] + t*(nodes[k][1]-nodes[k-1][1]);
+  };
+  return {{ channel({{{0, 0}}, {{.35, 0}}, {{.66, 1}}, {{.89, 1}}, {{1, .5}}}),
+            channel({{{0, 0}}, {{.125, 0}}, {{.375, 1}}, {{.64, 1}}, {{.91, 0}}, {{1, 0}}}),
+            channel({{{0, .5}}, {{.11, 1}}, {{.34, 1}}, {{.65, 0}}, {{1, 0}}}) }};
+}
+
+// matplotlib's rainbow
+std::array<double, 3> rainbow(double x)
+{
+  return {{ abs(2*x-.5), sin(M_PI*x), cos(M_PI*x/2) }};
+}
+
+// =============================================================================
+// images
+
+// an rgb image in row major order from the top
+struct image
+{
+  int width, height;
+  std::vector<unsigned char> pixels;
+
+  image(int width, int height)
+    : width(width), height(height), pixels(3*size_t(width)*height, 255)
+  {}
+
+  // fill the square of a box given the pixel of its upper left corner
+  void fill(int i0, int j0, const color& c)
+  {
+    for(int i=i0; i<i0+scale; ++i)
+      for(int j=j0; j<j0+scale; ++j)
+        copy(begin(c), end(c), &pixels[3*(size_t(i)*width+j)]);
+  }
+};
+
+// color map of the composition for a number of types (as in plot.py)
+color_map composition_map(int ntypes)
+{
+  return ntypes==3 ? color_map(jet) : ntypes>3 ? color_map(rainbow) : color_map(viridis);
+}
+
+// draw the panels of a frame as plot_frame does
+image render(const frame& f, const run& r, const color_map& composition)
+{
+  static const color_map density(viridis);
+
+  const size_t nboxes = size_t(r.nx)*r.ny;
+  vector<double> d(nboxes, 0.), h(nboxes, 0.);
+  for(int s=0; s<r.ntypes; ++s)
+    for(size_t k=0; k<nboxes; ++k)
+    {
+      d[k] += f.density[s*nboxes+k];
+      h[k] += f.density[s*nboxes+k]*(s+.5);
+    }
+
+  // the total density is scaled to its range in the frame
+  const auto range = minmax_element(begin(d), end(d));
+  const double dmin = *range.first;
+  const double dspan = *range.second - dmin;
+
+  // the first index of the frames goes upwards (origin='lower')
+  image img(2*r.ny*scale + gap, r.nx*scale);
+  for(int a=0; a<r.nx; ++a)
+    for(int c=0; c<r.ny; ++c)
+    {
+      const size_t k = size_t(a)*r.ny + c;
+      const int i = (r.nx-1-a)*scale;
+      // the composition as in plot.py (the types are weighted by s+.5 and
+      // the total is shifted by .5), empty boxes are left blank
+      if(d[k]>0)
+        img.fill(i, c*scale, composition((h[k]-.5)/(r.ntypes-.5)/d[k]));
+      img.fill(i, (r.ny+c)*scale + gap, density(dspan>0 ? (d[k]-dmin)/dspan : 0.));
+    }
+
+  return img;
+}
+
+// =============================================================================
+// image files
+
+// append a 32 bit big endian integer
+void put32(string& s, uint32_t v)
+{
+  for(int i=3; i>=0; --i) s += char((v>>(8*i))&0xff);
+}
+
+// crc of the png chunks
+uint32_t crc32_png(const string& s, size_t first)
+{
+  static const auto table = [] {
+    std::array<uint32_t, 256> t;
+    for(uint32_t n=0; n<256; ++n)
+    {
+      uint32_t c = n;
+      for(int k=0; k<8; ++k) c = c&1 ? 0xedb88320u^(c>>1) : c>>1;
+      t[n] = c;
+    }
+    return t;
+  }();
+
+  uint32_t c = 0xffffffffu;
+  for(size_t k=first; k<s.size(); ++k)
+    c = table[(c^(unsigned char)s[k])&0xff]^(c>>8);
+  return c^0xffffffffu;
+}
+
+// append a png chunk
+void put_chunk(string& s, const char* type, const string& data)
+{
+  put32(s, data.size());
+  const size_t first = s.size();
+  s += type;
+  s += data;
+  put32(s, crc32_png(s, first));
+}
+
+// zlib stream of the scanlines (fast compression if zlib is available, stored
+// blocks otherwise)
+string deflate_rows(const string& raw)
+{
+#ifdef MPCD_ZLIB
+  uLongf size = compressBound(raw.size());
+  string out(size, '\0');
+  if(compress2(reinterpret_cast<Bytef*>(&out[0]), &size,
+               reinterpret_cast<const Bytef*>(raw.data()), raw.size(),
+               Z_BEST_SPEED)!=Z_OK)
+    throw inline_str("unable to compress an image");
+  out.resize(size);
+  return out;
+#else
+  string out("\x78\x01", 2);
+  for(size_t p=0; p<raw.size() or p==0; p+=65535)
+  {
+    const size_t n = min<size_t>(65535, raw.size()-p);
+    out += char(p+n>=raw.size());
+    out += char(n&0xff);
+    out += char(n>>8);
+    out += char(~n&0xff);
+    out += char((~n>>8)&0xff);
+    out.append(raw, p, n);
+  }
+  uint32_t a = 1, b = 0;
+  for(const char c : raw)
+  {
+    a = (a+(unsigned char)c)%65521;
+    b = (b+a)%65521;
+  }
+  put32(out, b<<16|a);
+  return out;
+#endif
+}
+
+// write an image as png or binary ppm
+void write_image(const string& fname, const image& img)
+{
+  string s;
+  if(format=="ppm")
+  {
+    s = inline_str("P6\n", img.width, " ", img.height, "\n255\n");
+    s.append(img.pixels.begin(), img.pixels.end());
+  }
+  else
+  {
+    // every scanline starts with its filter (none)
+    const size_t row = 3*size_t(img.width);
+    string raw;
+    raw.reserve((row+1)*img.height);
+    for(int i=0; i<img.height; ++i)
+    {
+      raw += '\0';
+      raw.append(img.pixels.begin() + i*row, img.pixels.begin() + (i+1)*row);
+    }
+
+    string header;
+    put32(header, img.width);
+    put32(header, img.height);
+    // 8 bit rgb, deflate, no interlacing
+    header += string("\x08\x02\x00\x00\x00", 5);
+
+    s = "\x89PNG\r\n\x1a\n";
+    put_chunk(s, "IHDR", header);
+    put_chunk(s, "IDAT", deflate_rows(raw));
+    put_chunk(s, "IEND", "");
+  }
+
+  ofstream file(fname, ios::out | ios::binary);
+  file.write(s.data(), s.size());
+  if(not file.good()) throw inline_str("unable to write file ", fname);
+}
+
+// name of the image of a frame (zero padded such that the images are sorted)
+string image_file(long time)
+{
+  stringstream s;
+  s << outdir << "/frame" << setw(digits) << setfill('0') << time << "." << format;
+  return s.str();
+}
+
+// =============================================================================
+// rendering
+
+// render all the frames written by a run, returns the number of frames
+long render_files(const run& r)
+{
+  // frames that are on disk (the run may still be going or may have stopped)
+  vector<long> times;
+  for(long t=0; t<=r.nsteps; t+=r.ninfo)
+    if(access(species_file(directory, t, 0).c_str(), R_OK)==0) times.push_back(t);
+
+  digits = to_string(r.nsteps).size();
+
+  // every thread reads and renders its own frames
+  const auto composition = composition_map(r.ntypes);
+  string error;
+#pragma omp parallel for schedule(dynamic, 1)
+  for(size_t n=0; n<times.size(); ++n)
+  {
+    try
+    {
+      write_image(image_file(times[n]), render(read_frame(directory, r, times[n]), r, composition));
+    }
+    catch(const string& s)
+    {
+#pragma omp critical
+      error = s;
+    }
+  }
+  if(not error.empty()) throw error;
+
+  return times.size();
+}
+
+// render the frames published by a running simulation until it stops,
+// returns the number of frames
+long render_shm(const string& name)
+{
+  frame_subscriber subscriber(name);
+  const auto& header = subscriber.get_header();
+  if(header.dim!=2) throw inline_str("only two dimensional frames can be rendered");
+
+  const run r { int(header.ntypes), 0, 1, int(header.L[0]), int(header.L[1]) };
+  const size_t nboxes = header.nboxes;
+  const auto composition = composition_map(r.ntypes);
+
+  // the publisher removes the object when done
+  const auto published = [&name] {
+    return access(inline_str("/dev/shm/", name[0]=='/' ? name.substr(1) : name).c_str(), F_OK)==0;
+  };
+
+  long count = 0;
+  uint64_t next = max<uint64_t>(1, header.head.load());
+  // when the last frame was seen (a publisher that died does not remove the
+  // object and the sequence simply stops)
+  auto seen = chrono::steady_clock::now();
+  while(true)
+  {
+    const uint64_t head = header.head.load();
+    if(head<next)
+    {
+      if(not published()) break;
+      if(chrono::duration<double>(chrono::steady_clock::now() - seen).count()>timeout)
+        throw inline_str("no frame published to ", name, " for ", timeout,
+                         " s, the simulation may have died");
+      this_thread::sleep_for(chrono::milliseconds(10));
+      continue;
+    }
+    seen = chrono::steady_clock::now();
+
+    // frames that were overwritten before being copied are skipped
+    for(; next<=head; ++next)
+    {
+      frame_view view;
+      if(not subscriber.get(next, view)) continue;
+      frame f { long(view.time), vector<int>(view.density, view.density + r.ntypes*nboxes) };
+      if(not subscriber.valid(view)) continue;
+
+      write_image(image_file(f.time), render(f, r, composition));
+      ++count;
+    }
+  }
+
+  return count;
+}
+
+// =============================================================================
+
+void parse_options(int ac, char **av)
+{
+  opt::options_description generic("Options");
+  generic.add_options()
+    ("help,h", "produce help message")
+    ("directory", opt::value<string>(&directory), "output directory of the run")
+    ("images", opt::value<string>(&outdir), "directory of the images (default=directory/images)")
+    ("format", opt::value<string>(&format), "format of the images (png or ppm, default=png)")
+    ("scale", opt::value<int>(&scale), "size of the boxes in pixels (default=1)")
+    ("threads", opt::value<int>(&nthreads), "number of threads (default=all)")
+    ("shm", opt::value<string>(&shm), "render the frames published to this POSIX shared memory object")
+    ("timeout", opt::value<double>(&timeout), "seconds without a new published frame before giving up (default=300)")
+    ("verbose", opt::value<int>(&verbose)->implicit_value(2), "verbosity level (0, 1, 2, default=1)");
+
+  // first unnamed argument is the directory
+  opt::positional_options_description p;
+  p.add("directory", 1);
+
+  opt::variables_map vm;
+  opt::store(opt::command_line_parser(ac, av).options(generic).positional(p).run(), vm);
+  opt::notify(vm);
+
+  if(vm.count("help"))
+  {
+    cout << generic << endl;
+    exit(0);
+  }
+
+  if(directory.empty() and shm.empty())
+    throw inline_str("please specify the directory of a run");
+  if(outdir.empty())
+  {
+    if(directory.empty()) throw inline_str("please specify the directory of the images");
+    outdir = directory + "/images";
+  }
+  if(format!="png" and format!="ppm") throw inline_str("unknown image format ", format);
+  if(scale<1) throw inline_str("size of the boxes must be positive");
+}
+
+int main(int argc, char *argv[])
+{
+  try
+  {
+    parse_options(argc, argv);
+
+#ifdef _OPENMP
+    if(nthreads>0) omp_set_num_threads(nthreads);
+    nthreads = omp_get_max_threads();
+#else
+    nthreads = 1;
+#endif
+
+    make_directory(outdir);
+
+    const auto start = chrono::steady_clock::now();
+    const long count = shm.empty() ? render_files(read_run(directory)) : render_shm(shm);
+    const double time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    if(verbose)
+      cout << count << " frames rendered to " << outdir << " in " << time << " s ("
+           << count/time << " frames/s on " << nthreads << " threads)" << endl;
+  }
+  // error messages
+  catch(const string& s) {
+    cerr << argv[0] << ": " << s << endl;
+    return 1;
+  }
+  // all the rest (mainly from boost)
+  catch(const exception& e) {
+    cerr << argv[0] << ": " << e.what() << endl;
+    return 1;
+  }
+
+  return 0;
+}
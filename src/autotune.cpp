@@ -0,0 +1,211 @@
+//
+// calibration of the tunables of the engine
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <unistd.h>
+#include "autotune.hpp"
+#include "tools.hpp"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+  // print a list of values as in the runcards
+  template<class T>
+  string list(const vector<T>& values)
+  {
+    stringstream s;
+    s << "[";
+    for(size_t i=0; i<values.size(); ++i) s << (i ? "," : "") << values[i];
+    s << "]";
+    return s.str();
+  }
+
+  // wall clock time per step of a short burst
+  double burst(simulation& sim, const tuning& t)
+  {
+    t.apply(sim);
+    const auto timed = [&](int n) {
+      const auto start = chrono::steady_clock::now();
+      sim.step(n);
+      return chrono::duration<double>(chrono::steady_clock::now() - start).count()/n;
+    };
+
+    // warm up (thread pool, first touch, assignment of the particles), then
+    // keep the best of a few runs of about a tenth of a second
+    timed(1);
+    const int n = max(1, min(20, int(.1/timed(1))));
+    return min(timed(n), min(timed(n), timed(n)));
+  }
+
+  // find a cached tuning
+  bool load(const string& cache, const string& key, tuning& t)
+  {
+    ifstream file(cache);
+    for(string line; getline(file, line);)
+    {
+      const auto sep = line.rfind('\t');
+      if(sep==line.npos or line.substr(0, sep)!=key) continue;
+      stringstream s(line.substr(sep+1));
+      return bool(s >> t.threads >> t.chunks >> t.rebuild >> t.fused);
+    }
+    return false;
+  }
+
+  // add or replace a tuning in the cache (returns false if unwritable)
+  bool store(const string& cache, const string& key, const tuning& t)
+  {
+    vector<string> lines;
+    {
+      ifstream file(cache);
+      for(string line; getline(file, line);)
+        if(line.substr(0, line.rfind('\t'))!=key) lines.push_back(line);
+    }
+    lines.push_back(inline_str(key, "\t", t.threads, " ", t.chunks, " ", t.rebuild,
+                             " ", t.fused));
+
+    // replace atomically such that concurrent runs read a complete cache
+    const string tmp = inline_str(cache, ".", getpid());
+    bool written;
+    {
+      ofstream file(tmp);
+      for(const auto& line : lines) file << line << endl;
+      written = file.good();
+    }
+    if(written and rename(tmp.c_str(), cache.c_str())==0) return true;
+    remove(tmp.c_str());
+    return false;
+  }
+} // namespace
+
+void tuning::apply(simulation& sim) const
+{
+#ifdef _OPENMP
+  omp_set_num_threads(threads);
+#endif
+  sim.get_grid().set_chunks_per_thread(chunks);
+  sim.get_grid().set_rebuild(rebuild);
+  sim.get_grid().set_fused(fused);
+}
+
+string describe(const tuning& t)
+{
+  return inline_str(t.threads, " threads, ", t.chunks, " chunks per thread, ",
+                    t.rebuild ? "rebuilding" : "migrating",
+                    t.fused ? ", tiled steps" : "");
+}
+
+string machine_signature()
+{
+  string model = "unknown";
+  ifstream cpuinfo("/proc/cpuinfo");
+  for(string line; getline(cpuinfo, line);)
+    if(line.compare(0, 10, "model name")==0)
+    {
+      model = line.substr(line.find(':')+2);
+      break;
+    }
+
+  return inline_str(model, " x", sysconf(_SC_NPROCESSORS_ONLN));
+}
+
+string problem_signature(const parameters& params)
+{
+  // the interactions set the number of particles moved at each step, the
+  // rotation and the thermostat the cost of the srd collisions
+  string key = inline_str("L=", list(params.L), " ntypes=", params.ntypes,
+                          " dens=", list(params.dens),
+                          " kappa=", list(params.kappa), " M=", list(params.M),
+                          " tau=", params.tau, " engine=", params.engine);
+  if(params.engine=="srd")
+    key += inline_str(" angle=", params.angle,
+                      " thermostat=", params.thermostat);
+  return key;
+}
+
+tuning autotune(const parameters& params, int max_threads,
+                const string& cache, int verbose)
+{
+  const string key = inline_str(machine_signature(), " (", max_threads, " threads)\t",
+                                problem_signature(params));
+
+  tuning best;
+  if(load(cache, key, best))
+  {
+    if(verbose) cout << "tuning found in " << cache << endl;
+    return best;
+  }
+
+  simulation sim(params);
+
+  double fastest = 1e300;
+  const auto candidate = [&](const tuning& t) {
+    const double time = burst(sim, t);
+    if(verbose>1) cout << describe(t) << ": " << 1e3*time << " ms/step" << endl;
+    if(time<fastest)
+    {
+      fastest = time;
+      best = t;
+    }
+  };
+
+  // threads first (powers of two and all of them)...
+  for(int n=1; n<max_threads; n*=2)
+  {
+    tuning t = best;
+    t.threads = n;
+    candidate(t);
+  }
+  {
+    tuning t = best;
+    t.threads = max_threads;
+    candidate(t);
+  }
+
+  // ... then the bucketing and the fusion of the phases...
+  {
+    tuning t = best;
+    t.rebuild = not t.rebuild;
+    candidate(t);
+  }
+  {
+    tuning t = best;
+    t.fused = not t.fused;
+    candidate(t);
+  }
+
+  // ... and the size of the chunks
+  for(int c : { 1, 2, 8, 16 })
+  {
+    tuning t = best;
+    t.chunks = c;
+    candidate(t);
+  }
+
+  // the tuning is still used if it can not be cached
+  const bool stored = store(cache, key, best);
+  if(verbose)
+    cout << (stored ? "tuning stored in " : "warning: unable to write the "
+             "tuning cache ") << cache << endl;
+  return best;
+}
+
+string default_tuning_cache()
+{
+  if(const char* cache = getenv("MPCD_CACHE")) return cache;
+
+  const char* home = getenv("HOME");
+  if(not home) return ".mpcd-autotune";
+  make_directory(inline_str(home, "/.cache"));
+  return inline_str(home, "/.cache/mpcd-autotune");
+}
@@ -0,0 +1,53 @@
+// autotune.hpp
+// calibration of the tunables of the engine
+
+#ifndef AUTOTUNE_HPP_
+#define AUTOTUNE_HPP_
+
+#include <string>
+#include "simulation.hpp"
+
+// the tunables of the engine
+struct tuning
+{
+  // number of threads
+  int threads = 1;
+  // collision chunks of each thread
+  int chunks = 4;
+  // rebuild the boxes at every step instead of migrating the particles
+  bool rebuild = false;
+  // do the time steps tile by tile
+  bool fused = true;
+
+  // set the number of threads and tune the grid of a system
+  void apply(simulation& sim) const;
+};
+
+// human readable description of a tuning
+std::string describe(const tuning& t);
+
+// identifies the node (processor and number of cores)
+std::string machine_signature();
+// identifies the cost of a time step (size, densities, types, interactions,
+// engine, ...)
+std::string problem_signature(const parameters& params);
+
+/** Find the fastest tuning for a system on the current node
+ *
+ * Times short bursts of time steps of a system created from the parameters
+ * for every candidate: the number of threads is tuned first, then the
+ * bucketing strategy, the fusion of the phases and finally the number of
+ * collision chunks (a greedy
+ * search, the tunables being mostly independent). The result is cached
+ * under the machine and problem signatures in the given file, such that
+ * later runs of the same problem on the same kind of node skip the
+ * calibration (a cache that can not be written only gives a warning). At
+ * most max_threads threads are used.
+ * */
+tuning autotune(const parameters& params, int max_threads,
+                const std::string& cache, int verbose);
+
+// default location of the cache ($MPCD_CACHE or ~/.cache/mpcd-autotune)
+std::string default_tuning_cache();
+
+#endif//AUTOTUNE_HPP_
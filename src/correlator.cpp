@@ -0,0 +1,268 @@
+//
+// online time correlation functions
+//
+
+#include <cctype>
+#include <fstream>
+#include "correlator.hpp"
+
+using namespace std;
+
+namespace
+{
+  // names of the observables in a list such as '[vacf, msd]'
+  vector<string> parse(const string& observables)
+  {
+    vector<string> names;
+    string name;
+    for(size_t k=0; k<=observables.size(); ++k)
+    {
+      if(k<observables.size() and isalnum(observables[k]))
+      {
+        name += observables[k];
+        continue;
+      }
+      if(name.empty()) continue;
+      if(name!="vacf" and name!="msd" and name!="density")
+        throw inline_str("unknown observable ", name);
+      names.push_back(name);
+      name.clear();
+    }
+    return names;
+  }
+
+  // write a correlation function
+  void write_correlation(const string& fname, const string& header,
+                         const multi_tau& c, double dt, double norm)
+  {
+    ofstream file(fname, ios::out);
+    if(not file.good()) throw inline_str("unable to write file ", fname);
+
+    file << "# " << header << endl;
+    const auto lags = c.get_lags();
+    const auto values = c.get_correlations();
+    for(size_t n=0; n<lags.size(); ++n)
+    {
+      file << lags[n]*dt;
+      for(const auto v : values[n]) file << " " << v/norm;
+      file << endl;
+    }
+  }
+} // namespace
+
+multi_tau::multi_tau(size_t channels, size_t ngroups, estimator e, int p, int m)
+  : channels(channels), ngroups(ngroups), p(p), m(m), e(e)
+{}
+
+void multi_tau::add(size_t l, const double* value)
+{
+  if(l==levels.size())
+  {
+    levels.emplace_back();
+    auto& n = levels.back();
+    n.values.resize(p*channels);
+    n.accumulator.assign(channels, 0.);
+    n.sums.assign(p*ngroups, 0.);
+    n.counts.assign(p, 0);
+  }
+
+  auto& level = levels[l];
+  level.head = (level.head+1)%p;
+  level.size = min(level.size+1, p);
+  copy(value, value+channels, &level.values[level.head*channels]);
+
+  // correlate with the older values (the first lags of the higher levels
+  // are already covered by the lower ones)
+  const size_t per_group = channels/ngroups;
+  for(int j = l==0 ? 0 : p/m; j<level.size; ++j)
+  {
+    const double* old = &level.values[((level.head-j+p)%p)*channels];
+    for(size_t g=0; g<ngroups; ++g)
+    {
+      double sum = 0;
+      for(size_t c=g*per_group; c<(g+1)*per_group; ++c)
+        sum += e==product ? old[c]*value[c]
+                          : (value[c]-old[c])*(value[c]-old[c]);
+      level.sums[j*ngroups+g] += sum;
+    }
+    ++level.counts[j];
+  }
+
+  // pass the block averages to the next level
+  for(size_t c=0; c<channels; ++c) level.accumulator[c] += value[c];
+  if(++level.naccumulated==m)
+  {
+    vector<double> average(channels);
+    for(size_t c=0; c<channels; ++c)
+    {
+      average[c] = level.accumulator[c]/m;
+      level.accumulator[c] = 0;
+    }
+    level.naccumulated = 0;
+    // the levels may be reallocated
+    add(l+1, average.data());
+  }
+}
+
+void multi_tau::sample(const vector<double>& value)
+{
+  add(0, value.data());
+}
+
+vector<long> multi_tau::get_lags() const
+{
+  vector<long> lags;
+  long scale = 1;
+  for(size_t l=0; l<levels.size(); ++l, scale*=m)
+    for(int j = l==0 ? 0 : p/m; j<p; ++j)
+      if(levels[l].counts[j]) lags.push_back(j*scale);
+  return lags;
+}
+
+vector<vector<double>> multi_tau::get_correlations() const
+{
+  vector<vector<double>> values;
+  for(size_t l=0; l<levels.size(); ++l)
+    for(int j = l==0 ? 0 : p/m; j<p; ++j)
+      if(const long n = levels[l].counts[j])
+      {
+        values.emplace_back(ngroups);
+        for(size_t g=0; g<ngroups; ++g)
+          values.back()[g] = levels[l].sums[j*ngroups+g]/n;
+      }
+  return values;
+}
+
+void correlations::check(const string& observables, const parameters& params,
+                         size_t ntracers, int kmax, int every)
+{
+  const auto names = parse(observables);
+  if(every<1) throw inline_str("time steps between samples must be positive");
+  if(find(begin(names), end(names), "density")!=end(names)
+     and (kmax<1 or 2*kmax>*min_element(begin(params.L), end(params.L))))
+    throw inline_str("number of density modes must be in [1, L/2]");
+  if((find(begin(names), end(names), "vacf")!=end(names)
+      or find(begin(names), end(names), "msd")!=end(names))
+     and (ntracers<1 or ntracers>size_t(params.ntot())))
+    throw inline_str("number of tracers must be in [1, number of particles]");
+}
+
+correlations::correlations(const simulation& sim, const string& observables,
+                           size_t ntracers, int kmax, int every)
+  : kmax(kmax), dt(every*sim.get_parameters().tau),
+    nparticles(sim.get_parameters().ntot())
+{
+  const auto names = parse(observables);
+  const auto has = [&](const string& s) {
+    return find(begin(names), end(names), s)!=end(names);
+  };
+  vacf = has("vacf");
+  msd = has("msd");
+  density = has("density");
+
+  // tracers evenly spread over the store
+  const auto& particles = sim.get_particles();
+  if(vacf or msd)
+    for(size_t k=0; k<ntracers; ++k)
+      tracers.push_back(k*particles.size()/ntracers);
+
+  if(vacf)
+    vacf_correlator.reset(new multi_tau(dim*tracers.size(), 1, multi_tau::product));
+  if(msd)
+  {
+    msd_correlator.reset(new multi_tau(dim*tracers.size(), 1, multi_tau::square_distance));
+    for(auto k : tracers)
+    {
+      last.push_back(particles[k].x);
+      for(int i=0; i<dim; ++i) position.push_back(particles[k].x[i]);
+    }
+  }
+  // real and imaginary parts along each axis for each mode
+  if(density)
+    density_correlator.reset(new multi_tau(2*dim*kmax, kmax, multi_tau::product));
+}
+
+void correlations::sample(const simulation& sim)
+{
+  const auto& particles = sim.get_particles();
+  const auto& params = sim.get_parameters();
+  ++nsamples;
+
+  if(vacf)
+  {
+    vector<double> value(dim*tracers.size());
+    for(size_t k=0; k<tracers.size(); ++k)
+      for(int i=0; i<dim; ++i)
+        value[dim*k+i] = particles[tracers[k]].v[i];
+    vacf_correlator->sample(value);
+  }
+
+  if(msd)
+  {
+    // unwrap the displacements since the last sample
+    for(size_t k=0; k<tracers.size(); ++k)
+    {
+      const auto& x = particles[tracers[k]].x;
+      for(int i=0; i<dim; ++i)
+      {
+        double d = double(x[i]) - last[k][i];
+        if(d>=params.L[i]/2.) d -= params.L[i];
+        if(d<-params.L[i]/2.) d += params.L[i];
+        position[dim*k+i] += d;
+      }
+      last[k] = x;
+    }
+    msd_correlator->sample(position);
+  }
+
+  if(density)
+  {
+    // the modes along the axes only need the sums over the rows and columns
+    const auto& shift = sim.get_grid().get_shift();
+    const auto& boxes = sim.get_grid().get_boxes();
+    vector<vector<double>> sums(dim);
+    for(int i=0; i<dim; ++i) sums[i].assign(params.L[i], 0.);
+    for(size_t k=0; k<boxes.size(); ++k)
+    {
+      sums[0][k/params.L[1]] += boxes.occupancy(k);
+      sums[1][k%params.L[1]] += boxes.occupancy(k);
+    }
+
+    vector<double> value(2*dim*kmax);
+    for(int n=1; n<=kmax; ++n)
+      for(int i=0; i<dim; ++i)
+      {
+        // the centers of the boxes are shifted
+        const double q = 2*M_PI*n/params.L[i];
+        double re = 0, im = 0;
+        for(int a=0; a<params.L[i]; ++a)
+        {
+          re += sums[i][a]*cos(q*(a+.5-shift[i]));
+          im += sums[i][a]*sin(q*(a+.5-shift[i]));
+        }
+        value[2*dim*(n-1)+2*i] = re;
+        value[2*dim*(n-1)+2*i+1] = im;
+      }
+    density_correlator->sample(value);
+  }
+}
+
+void correlations::write(const string& dir) const
+{
+  const auto& header = inline_str("lag (", nsamples, " samples)");
+
+  if(vacf)
+    write_correlation(inline_str(dir, "/correlation.vacf"), header + " <v(0).v(t)>",
+                      *vacf_correlator, dt, tracers.size());
+  if(msd)
+    write_correlation(inline_str(dir, "/correlation.msd"), header + " <|r(t)-r(0)|^2>",
+                      *msd_correlator, dt, tracers.size());
+  if(density)
+  {
+    // averaged over the axes and normalized by the number of particles
+    string modes;
+    for(int n=1; n<=kmax; ++n) modes += inline_str(" F(k=2pi*", n, "/L)");
+    write_correlation(inline_str(dir, "/correlation.density"), header + modes,
+                      *density_correlator, dt, dim*nparticles);
+  }
+}
@@ -0,0 +1,127 @@
+// correlator.hpp
+// online time correlation functions
+
+#ifndef CORRELATOR_HPP_
+#define CORRELATOR_HPP_
+
+#include <string>
+#include <vector>
+#include "simulation.hpp"
+
+/** Multiple-tau correlator
+ *
+ * Time correlation of a set of channels (signals sampled at regular
+ * intervals) computed on the fly: level l keeps the last p block averages of
+ * m^l samples of every channel and correlates each new one with them, such
+ * that the lags j*m^l (p/m <= j < p) are covered with O(p log T) memory and
+ * O(p) operations per sample and channel (amortized). The correlations are
+ * summed over the channels of each group, the groups being contiguous ranges
+ * of equal size.
+ *
+ * See J. Ramirez, S.K. Sukumaran, B. Vorselaars and A.E. Likhtman, J. Chem.
+ * Phys. 133, 154103 (2010).
+ * */
+class multi_tau
+{
+public:
+  // what is correlated
+  enum estimator
+  {
+    // a(t)*a(t+tau)
+    product,
+    // (a(t+tau)-a(t))^2
+    square_distance
+  };
+
+private:
+  // number of channels, groups, length of the buffers and averaging factor
+  std::size_t channels, ngroups;
+  int p, m;
+  estimator e;
+
+  // a level of the correlator
+  struct level
+  {
+    // circular buffer of the last p values of all channels (in double
+    // precision, as the unwrapped positions grow without bound)
+    std::vector<double> values;
+    // position of the newest value and number of values
+    int head = -1, size = 0;
+    // sum of the values to be averaged for the next level and their number
+    std::vector<double> accumulator;
+    int naccumulated = 0;
+    // sums of the correlations of each group at each lag and their number
+    std::vector<double> sums;
+    std::vector<long> counts;
+  };
+  std::vector<level> levels;
+
+  // add a value at a given level
+  void add(std::size_t l, const double* value);
+
+public:
+  multi_tau(std::size_t channels, std::size_t ngroups, estimator e,
+            int p = 16, int m = 2);
+
+  // add a sample of all channels
+  void sample(const std::vector<double>& value);
+
+  // lags (in samples) and correlation of each group at these lags
+  std::vector<long> get_lags() const;
+  std::vector<std::vector<double>> get_correlations() const;
+};
+
+/** Dynamic observables of a system
+ *
+ * Online correlators fed from the particles and the boxes inside the time
+ * loop:
+ *
+ *  - vacf: velocity autocorrelation <v(t).v(t+tau)> of the tracer particles,
+ *  - msd: mean square displacement <|r(t+tau)-r(t)|^2> of the tracers,
+ *  - density: intermediate scattering function Re<rho_k(t) rho_k(t+tau)*>/N
+ *    of the total density of the boxes at the smallest wave vectors k along
+ *    the axes, k = 2 pi n/L for n = 1..kmax.
+ *
+ * The tracers are evenly spread over the particle store (i.e. over the
+ * types). The displacements are unwrapped from the periodic positions, such
+ * that the particles must move less than half the system size between two
+ * samples.
+ * */
+class correlations
+{
+  bool vacf, msd, density;
+  // index of the tracers in the particle store
+  std::vector<std::size_t> tracers;
+  // unwrapped positions of the tracers and their last periodic positions
+  std::vector<double> position;
+  std::vector<vec> last;
+  // number of modes of the density
+  int kmax;
+  // time between samples
+  double dt;
+  // total number of particles
+  double nparticles;
+  // the correlators (null if not measured)
+  std::unique_ptr<multi_tau> vacf_correlator, msd_correlator, density_correlator;
+  // samples taken
+  long nsamples = 0;
+
+public:
+  // check the names of the observables and the parameters (throws a string
+  // on error)
+  static void check(const std::string& observables, const parameters& params,
+                    std::size_t ntracers, int kmax, int every);
+
+  // correlate the given observables (e.g. '[vacf, msd]') with samples every
+  // 'every' time steps
+  correlations(const simulation& sim, const std::string& observables,
+               std::size_t ntracers, int kmax, int every);
+
+  // add a sample of the current state (after a time step)
+  void sample(const simulation& sim);
+
+  // write the correlations to dir/correlation.name for every observable
+  void write(const std::string& dir) const;
+};
+
+#endif//CORRELATOR_HPP_
@@ -0,0 +1,42 @@
+//
+// time series of the global conserved quantities
+//
+
+#include "diagnostics.hpp"
+#include "tools.hpp"
+
+using namespace std;
+
+diagnostics_writer::diagnostics_writer(const string& fname, const parameters& params)
+  : file(fname, ios::out | ios::binary)
+{
+  if(not file.good()) throw inline_str("unable to open file ", fname);
+
+  diagnostics_header h;
+  h.magic = diagnostics_magic;
+  h.dim = dim;
+  h.ntypes = params.ntypes;
+  write_binary(file, h);
+}
+
+void diagnostics_writer::write(int64_t time, const totals& t)
+{
+  write_binary(file, time);
+  for(int i=0; i<dim; ++i) write_binary(file, t.momentum[i]);
+  write_binary(file, t.ekin);
+  file.write(reinterpret_cast<const char*>(t.counts.data()),
+             t.counts.size()*sizeof(int64_t));
+
+  if(empty)
+  {
+    first = t;
+    empty = false;
+    return;
+  }
+
+  const double n = accumulate(begin(first.counts), end(first.counts), int64_t(0));
+  for(int i=0; i<dim; ++i)
+    momentum_drift = max(momentum_drift, abs(t.momentum[i]-first.momentum[i])/n);
+  for(size_t k=0; k<t.counts.size(); ++k)
+    count_drift = max(count_drift, abs(t.counts[k]-first.counts[k]));
+}
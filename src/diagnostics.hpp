@@ -0,0 +1,66 @@
+// diagnostics.hpp
+// time series of the global conserved quantities
+
+#ifndef DIAGNOSTICS_HPP_
+#define DIAGNOSTICS_HPP_
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include "model.hpp"
+
+/** Layout of the diagnostics file
+ *
+ * A diagnostics_header followed by one record per sample:
+ *
+ *   int64_t time                      time step
+ *   double  momentum[dim]             total momentum
+ *   double  ekin                      total kinetic energy
+ *   int64_t counts[ntypes]            number of particles of each type
+ *
+ * all in the byte order of the machine that wrote it.
+ * */
+struct diagnostics_header
+{
+  // identifies the file ("MPCDDIA1")
+  std::uint64_t magic;
+  // dimension of space and number of types
+  std::uint32_t dim, ntypes;
+};
+
+// magic number of the file
+constexpr std::uint64_t diagnostics_magic = 0x314149444443504dull;
+
+/** Write the totals of every collision to a binary time series
+ *
+ * Also keeps track of the largest deviations from the first sample, i.e. the
+ * drift of the quantities that are conserved by the collision.
+ * */
+class diagnostics_writer
+{
+  std::ofstream file;
+  // the first sample
+  totals first;
+  bool empty = true;
+  // largest drift of the momentum (per particle) and of the counts
+  double momentum_drift = 0;
+  std::int64_t count_drift = 0;
+
+public:
+  diagnostics_writer(const std::string& fname, const parameters& params);
+
+  // append a sample
+  void write(std::int64_t time, const totals& t);
+  // write the buffered samples
+  void flush()
+  { file.flush(); }
+
+  // largest deviation of the momentum per particle from the first sample
+  double get_momentum_drift() const
+  { return momentum_drift; }
+  // largest deviation of the number of particles of any type
+  std::int64_t get_count_drift() const
+  { return count_drift; }
+};
+
+#endif//DIAGNOSTICS_HPP_
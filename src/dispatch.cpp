@@ -0,0 +1,21 @@
+//
+// kernels compiled for several instruction sets
+//
+
+#include "dispatch.hpp"
+
+const char* kernel_isa()
+{
+#if defined(MPCD_DISPATCH) && defined(__x86_64__) && defined(__GNUC__)
+  // same order of preference as the resolvers of the kernels
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx512f")) return "avx512f";
+  if(__builtin_cpu_supports("avx2")) return "avx2";
+  if(__builtin_cpu_supports("sse4.2")) return "sse4.2";
+  return "x86-64";
+#elif defined(__x86_64__)
+  return "x86-64 (no dispatch)";
+#else
+  return "generic (no dispatch)";
+#endif
+}
@@ -0,0 +1,33 @@
+// dispatch.hpp
+// kernels compiled for several instruction sets
+
+#ifndef DISPATCH_HPP_
+#define DISPATCH_HPP_
+
+/** Multi-versioned kernels
+ *
+ * Functions marked KERNEL are compiled for AVX-512, AVX2, SSE4.2 and the
+ * generic x86-64 baseline, the best version for the cpu being selected once
+ * when the program is loaded (gcc/clang function multi-versioning). The
+ * inline functions they call are compiled along, such that a single binary
+ * runs at full speed on all node generations of a cluster. Disabled with
+ * -DMPCD_DISPATCH=OFF or on other architectures.
+ * */
+#if defined(MPCD_DISPATCH) && defined(__x86_64__) && defined(__GNUC__)
+#define KERNEL __attribute__((target_clones("avx512f", "avx2", "sse4.2", "default")))
+#else
+#define KERNEL
+#endif
+
+// helpers of the kernels that are too large to be inlined by default (they
+// would only be compiled for the baseline)
+#if defined(__GNUC__)
+#define KERNEL_INLINE __attribute__((always_inline)) inline
+#else
+#define KERNEL_INLINE inline
+#endif
+
+// instruction set of the kernels selected for this cpu
+const char* kernel_isa();
+
+#endif//DISPATCH_HPP_
@@ -9,6 +9,8 @@
 #include <algorithm>
 #include <numeric>
 #include <functional>
+#include <chrono>
+#include <memory>
 #include <boost/program_options.hpp>
 
 #include "vector.hpp"
@@ -4,6 +4,22 @@
 #include "header.hpp"
 #include "random.hpp"
 #include "tools.hpp"
+#include "publish.hpp"
+#include "output.hpp"
+#include "simulation.hpp"
+#include "perf.hpp"
+#include "trace.hpp"
+#include "validate.hpp"
+#include "sweep.hpp"
+#include "autotune.hpp"
+#include "correlator.hpp"
+#include "diagnostics.hpp"
+#include <exception>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace std;
 namespace opt = boost::program_options;
@@ -11,22 +27,10 @@ namespace opt = boost::program_options;
 // ===================================================================
 // parameters
 
-// time step
-float tau = 2e-2;
-// number of boxes in each dimension
-vector<int> L;
-// total number of boxes
-int nboxes;
-// number of particles
-vector<int> dens = {10};
-// number of particles of each type
-vector<int> npart;
-// total number of particles
-int ntot;
-// number of types
-int ntypes = 1;
-// interaction parameters
-vector<float> kappa;
+// parameters of the system
+parameters params;
+// seed of the random number generator (0 is random)
+unsigned seed = 0;
 // total number of time steps
 int nsteps = 100000;
 // number of steps between analyses
@@ -37,158 +41,55 @@ int verbose = 1;
 int width = 50;
 // intput/output directory
 string directory;
-
-// =============================================================================
-// components
-
-// single particle
-struct particle
-{
-  // current velocity and position
-  vec x, v;
-  // particle type
-  int t;
-
-  // one step forward
-  void stream()
-  {
-    for(int i=0; i<dim; ++i)
-      x[i] = modu(x[i] + tau*v[i], L[i]);
-  }
-};
-
-// box used for collision operation
-struct box
-{
-  // location of the center of the box
-  const vec x;
-  // number of particles of each type
-  vector<int> n;
-  // ptrs to particles
-  vector<particle*> particles;
-  // mean velocity and noise
-  vec vcm, ncm;
-  // total ekin
-  float ekin;
-
-  box(const vec& x)
-    : x(x)
-  {
-    n.resize(ntypes, 0);
-  }
-
-  // the collision operator
-  void collision(const vec& shift)
-  {
-    // compute box properties
-    vector<vec> grad (ntypes+1, {{0,0}});
-    //vector<vec> grad2(ntypes, {{0,0}});
-    vector<int> ngrad(ntypes, 0);
-    //int ngrad = 0;
-    vcm = ncm = {{ 0, 0 }};
-    for(const auto& p : particles)
-    {
-      // gradient
-      const vec d = modu(p->x + shift, L) - x;
-      if(d.sq()<.25f)
-      {
-        grad[p->t] += 12.f*d;
-        //grad2[p->t] += 480.f*d*(26.f*d*d + 6.f - 35.f*d.times(d));
-        ++ngrad[p->t];
-      }
-
-      // noise
-      vcm  += p->v;
-      p->v  = {{ random_normal(), random_normal() }};
-      ncm  += p->v;
-    }
-
-    normalize(vcm, particles.size());
-    normalize(ncm, particles.size());
-    for(int t=0; t<ntypes; ++t)
-    {
-      normalize(grad[t], ngrad[t]);
-      grad[ntypes] += grad[t]; // total grad
-    }
-
-    // perform collision
-    ekin = 0;
-    vec vcm_corr = {{0,0}};
-    for(const auto& p : particles)
-    {
-      p->v += vcm - ncm;
-
-      for(int t=0; t<ntypes; ++t)
-        p->v += kappa[p->t]*kappa[t]/n[p->t]/particles.size()
-                //*(grad[p->t]-grad[t]-grad[ntypes]*(n[p->t]-n[t])/particles.size());
-                *grad[p->t];
-
-      vcm_corr += p->v;
-      ekin += p->v.sq()/2;
-    }
-
-    // correct for momentum conservation
-    normalize(vcm_corr, particles.size());
-    for(const auto& p: particles)
-      p->v -= vcm_corr - vcm;
-  }
-
-  // add particles
-  void add(particle* p)
-  {
-    particles.push_back(p);
-    ++n[p->t];
-  }
-
-  // empty particle list
-  void clear()
-  {
-    particles.clear();
-    fill(begin(n), end(n), 0);
-  }
-};
-
-// set of boxes
-class grid
-{
-  // all boxes
-  vector<box> boxes;
-  // the current grid shift
-  vec shift;
-
-public:
-  grid()
-  {
-    for(int i=0; i<L[0]; ++i)
-      for(int j=0; j<L[1]; ++j)
-        boxes.push_back(vec {{i+.5f, j+.5f}});
-  }
-
-  void set_shift(const vec& s)
-  {
-    shift = s;
-  }
-
-  void bucket(particle* p)
-  {
-    // construct index from position
-    int index = 0;
-    for(int i=0; i<dim; ++i)
-      index = L[i]*index + int(modu(p->x[i]+shift[i], L[i]));
-
-    // add to corresponding box
-    boxes[index].add(p);
-  }
-
-  void clear() { for(auto& b : boxes) b.clear(); }
-  void collision() { for(auto& b : boxes) b.collision(shift); }
-
-  // iterators over the boxes
-  vector<box>::iterator begin() { return boxes.begin(); }
-  vector<box>::iterator end() { return boxes.end(); }
-  vector<box>::const_iterator begin() const { return boxes.begin(); }
-  vector<box>::const_iterator end() const { return boxes.end(); }
-};
+// record hardware counters for each phase
+bool perf = false;
+// record a timeline of the phases
+bool trace = false;
+// window of time steps to trace
+vector<int> trace_window;
+// number of steps of the validation runs (0 is no validation)
+int validate_steps = 0;
+// number of threads (0 is all available)
+int nthreads = 0;
+// do not write any frame
+bool no_output = false;
+// number of independent replicas run concurrently
+int nreplicas = 1;
+// interaction parameters of each replica (empty if all identical)
+vector<float> replica_kappa;
+// sweep specification (empty if not sweeping)
+string sweep_file;
+// number of branches forked from the equilibrated state (0 is no branching)
+int nbranches = 0;
+// number of equilibration steps before branching
+int nequil = 0;
+// shared memory object to publish the frames to (empty is none)
+string shm;
+// number of frames kept in shared memory
+int shm_slots = 8;
+// calibrate the tunables before running
+bool autotuning = false;
+// the tunables used (if autotuning)
+tuning tuned;
+// observables correlated online (empty is none)
+string correlate;
+// number of tracer particles of the correlators
+int ntracers = 1000;
+// number of density modes of the correlators
+int kmax = 4;
+// number of time steps between two samples of the correlators
+int ncorr = 1;
+// number of time steps between two samples of the diagnostics (0 is none)
+int ndiag = 0;
+// drifts of the conserved quantities of all systems
+double momentum_drift = 0;
+int64_t count_drift = 0;
+// reduction of the frames written to disk
+output_options output;
+// load balance of the collision of all systems
+load_balance balance;
+// time before the first step (random tables and particles)
+double startup = 0;
 
 // =============================================================================
 // input/output
@@ -197,25 +98,57 @@ public:
 void parse_options(int ac, char **av)
 {
   // we use strings to retreive the arrays
-  string kget, dget, Lget, gget;
+  string kget, dget, Lget, Mget, tget, rget, fget, gget;
+  int coarse = 1;
 
   // options allowed only in the command line
   opt::options_description generic("Generic options");
   generic.add_options()
     ("help,h", "produce help message")
     ("directory", opt::value<string>(&directory), "input/output directory")
-    ("verbose", opt::value<int>(&verbose)->implicit_value(2), "verbosity level (0, 1, 2, default=1)");
+    ("verbose", opt::value<int>(&verbose)->implicit_value(2), "verbosity level (0, 1, 2, default=1)")
+    ("threads", opt::value<int>(&nthreads), "number of threads (default=all)")
+    ("no-output", opt::bool_switch(&no_output), "do not write any frame (for benchmarking)")
+    ("autotune", opt::bool_switch(&autotuning), "calibrate the threads, chunks and bucketing for this runcard and node (cached)")
+    ("replicas", opt::value<int>(&nreplicas), "number of independent replicas run concurrently")
+    ("branches", opt::value<int>(&nbranches), "number of runs forked from the equilibrated state")
+    ("sweep", opt::value<string>(&sweep_file)->implicit_value("sweep"), "run the parameter sweep given in this file (default=sweep)")
+    ("shm", opt::value<string>(&shm), "publish the frames live to this POSIX shared memory object")
+    ("shm-slots", opt::value<int>(&shm_slots), "number of frames kept in shared memory (default=8)")
+    ("perf", opt::bool_switch(&perf), "record hardware performance counters for each phase")
+    ("trace", opt::bool_switch(&trace), "record a timeline of the phases (Chrome trace format)")
+    ("trace-window", opt::value<string>(&tget), "first and last time steps to trace, e.g. [100,200]")
+    ("validate", opt::value<int>(&validate_steps)->implicit_value(500), "compare all collision engines against the reference and exit");
 
   // options allowed only in the config file
   opt::options_description config("Configuration options");
   config.add_options()
     ("L", opt::value<string>(&Lget), "number of boxes")
     ("dens", opt::value<string>(&dget), "density of particles")
-    ("ntypes", opt::value<int>(&ntypes), "number of different types")
+    ("ntypes", opt::value<int>(&params.ntypes), "number of different types")
     ("nsteps", opt::value<int>(&nsteps), "total number of time steps")
     ("ninfo", opt::value<int>(&ninfo), "number of time steps between two analyses")
-    ("tau", opt::value<float>(&tau), "time step")
-    ("kappa", opt::value<string>(&kget), "interaction parameters");
+    ("tau", opt::value<float>(&params.tau), "time step")
+    ("engine", opt::value<string>(&params.engine), "collision engine (default=reference)")
+    ("angle", opt::value<float>(&params.angle), "rotation angle of the srd engine in degrees (default=130)")
+    ("thermostat", opt::value<bool>(&params.thermostat), "thermostat of the srd engine (default=false)")
+    ("seed", opt::value<unsigned>(&seed), "seed of the random number generator (default=random)")
+    ("kappa", opt::value<string>(&kget), "interaction parameters")
+    ("M", opt::value<string>(&Mget), "symmetric interaction matrix (ntypes x ntypes, replaces kappa)")
+    ("kappas", opt::value<string>(&rget), "interaction parameters of each replica or branch (N x ntypes)")
+    ("nequil", opt::value<int>(&nequil), "number of equilibration steps before branching")
+    ("output", opt::value<string>(&fget), "fields written to disk (default=[density, velocity, energy, species])")
+    ("coarse", opt::value<int>(&coarse), "size of the blocks the fields are coarse-grained over (default=1)")
+    ("region", opt::value<string>(&gget), "region of interest written to disk [x0, y0, x1, y1] (default=all)")
+    ("correlate", opt::value<string>(&correlate), "observables correlated online, e.g. [vacf, msd, density]")
+    ("tracers", opt::value<int>(&ntracers), "number of tracer particles of the vacf and msd (default=1000)")
+    ("kmax", opt::value<int>(&kmax), "number of density modes correlated (default=4)")
+    ("ncorr", opt::value<int>(&ncorr), "number of time steps between two samples of the correlators (default=1)")
+    ("ndiag", opt::value<int>(&ndiag), "number of time steps between two samples of the global diagnostics (default=0, none)");
+  for(int f=0; f<nfields; ++f)
+    config.add_options()
+      (inline_str("coarse.", field_names[f]).c_str(), opt::value<int>(&output.block[f]),
+       inline_str("size of the blocks of the ", field_names[f], " (default=coarse)").c_str());
 
   // command line options
   opt::options_description cmdline_options;
@@ -258,40 +191,38 @@ void parse_options(int ac, char **av)
   }
   else throw inline_str("please specify an input/output directory");
 
-  // get system size
-  L = get_ints_from_string(Lget);
-  if(L.size()!=dim) throw inline_str("wrong format for system size");
-
-  // total number of boxes
-  nboxes = accumulate(begin(L), end(L), 1, multiplies<int>());
-
-  // get number of particles array
-  dens = get_ints_from_string(dget);
-  if(dens.size()!=size_t(ntypes)) throw inline_str("wrong number of densities");
-
-  // get interaction params
-  kappa = get_floats_from_string(kget);
-  if(kappa.size()!=size_t(ntypes)) throw inline_str("wrong number of interaction parameters");
-
-  // total number of particles of each specie
-  npart.reserve(ntypes);
-  for(int t=0; t<ntypes; ++t)
-    npart.push_back(nboxes*dens[t]);
-  // total number of particles
-  ntot = accumulate(begin(npart), end(npart), 0.f);
-
-  /*
-  // dirty conversion to interaction matrix...
-  auto values = get_floats_from_string(Mget);
-  // ... check
-  if(values.size()!=ntypes*ntypes)
-    throw inline_str("wrong number of elements in interaction matrix");
-  // ... store
-  M.resize(ntypes);
-  for(int i=0; i<ntypes; ++i)
-    for(int j=0; j<ntypes; ++j)
-      M[i].push_back(values[ntypes*i + j]);
-  */
+  // get system size, densities and interaction params
+  params.L = get_ints_from_string(Lget);
+  params.dens = get_ints_from_string(dget);
+  params.kappa = get_floats_from_string(kget);
+  params.M = get_floats_from_string(Mget);
+  params.check();
+
+  // get the reduction of the frames (a field without its own coarse graining
+  // uses the common one)
+  if(not fget.empty()) output.set_fields(fget);
+  for(int f=0; f<nfields; ++f)
+    if(not vm.count(inline_str("coarse.", field_names[f]))) output.block[f] = coarse;
+  output.region = get_ints_from_string(gget);
+  output.check(params);
+  correlations::check(correlate, params, ntracers, kmax, ncorr);
+  if(ndiag<0) throw inline_str("time steps between diagnostics must be positive");
+
+  // get interaction params of the replicas or branches
+  if(nreplicas<1) throw inline_str("number of replicas must be positive");
+  if(nbranches and nreplicas>1)
+    throw inline_str("replicas and branches can not be used together");
+  if(autotuning and (nbranches or nreplicas>1))
+    throw inline_str("autotuning is only available for single runs");
+  replica_kappa = get_floats_from_string(rget);
+  if(not replica_kappa.empty()
+     and replica_kappa.size()!=size_t(max(nreplicas, nbranches)*params.ntypes))
+    throw inline_str("wrong number of interaction parameters for the replicas");
+
+  // get trace window (default is the whole run)
+  trace_window = get_ints_from_string(tget);
+  if(trace_window.empty()) trace_window = { 0, nsteps };
+  if(trace_window.size()!=2) throw inline_str("wrong format for trace window");
 
   // print the simulation parameters
   if(verbose)
@@ -300,118 +231,243 @@ void parse_options(int ac, char **av)
     cout << string(width, '=') << endl;
     print_vm(vm, width);
   }
+
+  // refuse to start if the node can not hold all the systems at once (the
+  // branches are copied on write by each child, one child per thread
+  // running at a time next to the parent)
+  if(sweep_file.empty())
+  {
+#ifdef _OPENMP
+    const int threads = nthreads>0 ? nthreads : omp_get_max_threads();
+#else
+    const int threads = 1;
+#endif
+    const size_t systems = validate_steps ? 1
+                         : nbranches ? min(nbranches, threads)+1 : nreplicas;
+    const size_t budget = systems*memory_estimate(params) + random_memory();
+    const size_t available = available_memory();
+
+    if(verbose)
+      cout << endl << "memory budget [MB] = " << budget/1048576.
+           << " (available " << available/1048576. << ")" << endl;
+    if(budget>available)
+      throw inline_str("not enough memory: the run needs ", budget/1048576,
+                       " MB but only ", available/1048576, " MB are available");
+  }
 }
 
-// write the current state
-void write_frame(int t,
-                 const grid& boxes,
-                 const vector<particle>& particles)
+// =============================================================================
+// simulation
+
+// run control of an independent realization of the system
+struct replica
 {
-  // helper to construct file names
-  const auto fname = [&](const string& s) {
-    return inline_str(directory, "/frame", t, ".", s, ".dat");
-  };
+  // index of the replica
+  int index;
+  // output directory
+  string directory;
+  // number of time steps
+  int steps;
+  // write frames?
+  bool output;
+  // publish frames to shared memory (may be null)
+  frame_publisher* publisher;
+};
 
-  // open files
-  vector<ofstream> files(3 + ntypes);
-  files[0].open(fname("density"), ios::out | ios::binary);
-  files[1].open(fname("velocity"), ios::out | ios::binary);
-  files[2].open(fname("energy"), ios::out | ios::binary);
-  for(size_t i=3; i<files.size(); ++i)
-    files[i].open(fname(inline_str("density.", i-3)), ios::out | ios::binary);
-  for(auto& f : files) if(not f.good())
-    throw inline_str("unable to open files for writing");
-
-  // write data
-  for(auto& b : boxes)
+// return the i-th replica (or branch)
+replica get_replica(int i, const string& dir)
+{
+  return { i, dir, nsteps, not no_output, nullptr };
+}
+
+// parameters of the i-th replica (or branch)
+parameters replica_parameters(int i)
+{
+  auto p = params;
+  if(not replica_kappa.empty())
   {
-    write_binary(files[0], b.particles.size());
-    write_binary(files[1], b.vcm);
-    write_binary(files[2], b.ekin);
-    for(int i=0; i<ntypes; ++i) write_binary(files[3+i], b.n[i]);
+    p.kappa.assign(begin(replica_kappa) + i*p.ntypes,
+                   begin(replica_kappa) + (i+1)*p.ntypes);
+    p.M.clear();
   }
+  return p;
+}
 
-  // close all files
-  for(auto& f : files) f.close();
+// run a system, returns the wall clock time of the time loop
+double simulate(simulation& sim, const replica& r)
+{
+  // only the first replica reports and is traced
+  const bool master = r.index==0;
 
-  // write particles
-  /*
-  {
-    ofstream file(fname("particles"), ios::out | ios::binary);
+  if(r.output) write_layout(r.directory, sim.get_parameters(), output);
 
-    for(auto& p : particles)
-      file << p.x[0] << p.x[1] << p.v[0] << p.v[1] << p.t;
+  // online correlators
+  unique_ptr<correlations> correlators;
+  if(r.output and not correlate.empty())
+    correlators.reset(new correlations(sim, correlate, ntracers, kmax, ncorr));
 
-    file.close();
-  }
-  */
-}
+  // global diagnostics
+  unique_ptr<diagnostics_writer> diagnostics;
+  if(r.output and ndiag)
+    diagnostics.reset(new diagnostics_writer(inline_str(r.directory, "/diagnostics.dat"),
+                                             sim.get_parameters()));
 
-// =============================================================================
-// simulation
+  const auto start = chrono::steady_clock::now();
 
-void simulate()
-{
-  // ---------------------------------------------------------------------------
-  // init
-
-  // create the particles at random
-  vector<particle> particles;
-  particles.reserve(ntot);
-  for(int t=0; t<ntypes; ++t)
-    for(int i=0; i<L[0]; ++i)
-      for(int j=0; j<L[1]; ++j)
-        for(int k=0; k<dens[t]; ++k)
-          particles.push_back({
-            {{ random_real(float(i), float(i+1)),
-               random_real(float(j), float(j+1)) }},
-            {{0,0}},
-            t});
-
-  // the grid
-  grid boxes;
-
-  // ---------------------------------------------------------------------------
-  // the algo
-
-  for(int time=0; time<=nsteps; ++time)
+  for(int time=0; time<=r.steps; ++time)
   {
-    // the random shift
-    boxes.set_shift(vec {{ random_real(), random_real() }});
+    if(master) trace_step(time);
+
+    sim.step();
 
-    // simulate particles
-    for(auto& p : particles)
+    if(correlators and time%ncorr==0)
     {
-      // stream
-      p.stream();
-      // bucket
-      boxes.bucket(&p);
+      phase_scope s(phase_analysis);
+      correlators->sample(sim);
+    }
+
+    if(diagnostics and time%ndiag==0)
+    {
+      phase_scope s(phase_output);
+      diagnostics->write(time, sim.get_grid().get_totals());
     }
 
     // store step
     if(time%ninfo == 0)
     {
       // print status
-      cout << "t = " << time <<  " / " << nsteps << endl;
+      if(master or verbose>1)
+      {
+#pragma omp critical
+        {
+          if(nreplicas>1) cout << "replica " << r.index << ": ";
+          cout << "t = " << time <<  " / " << r.steps << endl;
+        }
+      }
+      if(not r.output and not r.publisher) continue;
 
-      // collision
-      boxes.collision();
       // rebucket with zero shift before storing
-      boxes.clear();
-      boxes.set_shift({{0,0}});
-      for(auto& p : particles)
-        boxes.bucket(&p);
-      // store and clear
-      write_frame(time, boxes, particles);
-      boxes.clear();
+      sim.analyse();
+
+      // store
+      {
+        phase_scope s(phase_output);
+        if(r.publisher) r.publisher->publish(time, sim.get_grid());
+        if(r.output) write_frame(r.directory, time, sim.get_grid(), sim.get_parameters(), output);
+        // correlations and diagnostics so far
+        if(correlators) correlators->write(r.directory);
+        if(diagnostics) diagnostics->flush();
+      }
     }
-    // normal step
-    else
+  }
+  if(master) trace_done();
+
+  if(correlators) correlators->write(r.directory);
+
+  // drifts over the whole run
+  if(diagnostics)
+  {
+#pragma omp critical
     {
-      boxes.collision();
-      boxes.clear();
+      momentum_drift = max(momentum_drift, diagnostics->get_momentum_drift());
+      count_drift = max(count_drift, diagnostics->get_count_drift());
     }
   }
+
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// print the run statistics
+void write_summary(ostream& stream, double time)
+{
+  stream << "threads = " << nthreads << endl
+         << "replicas = " << nreplicas << endl
+         << "branches = " << nbranches << endl
+         << "steps = " << nsteps+1 << endl
+         << "particles = " << params.ntot() << endl
+         << "startup time [s] = " << startup << endl
+         << "wall time [s] = " << time << endl
+         << "time per step [ms] = " << 1e3*time/(nsteps+1)/nreplicas << endl
+         << "peak memory [MB] = " << peak_memory()/1048576. << endl;
+  if(autotuning)
+    stream << "tuning = " << describe(tuned) << endl;
+  if(ndiag)
+    stream << "momentum drift = " << momentum_drift << endl
+           << "count drift = " << count_drift << endl;
+  if(balance.steps)
+    stream << "collision balance = " << balance.efficiency() << endl
+           << "stolen chunks [%] = " << 100.*balance.stolen/balance.chunks << endl;
+  perf_summary(stream);
+}
+
+// equilibrate once and run the branches in forked processes, such that the
+// random tables and the equilibrated particles are shared copy-on-write
+// (returns the number of failed branches)
+int branch(simulation& sim)
+{
+  if(verbose) cout << "equilibration (" << nequil << " steps)" << endl;
+  simulate(sim, { 0, directory, nequil, false });
+
+  // wait for a single branch to finish
+  int running = 0, failed = 0;
+  const auto wait_one = [&]() {
+    int status;
+    if(wait(&status)<0 or not WIFEXITED(status) or WEXITSTATUS(status)) ++failed;
+    --running;
+  };
+
+  for(int i=0; i<nbranches; ++i)
+  {
+    // one branch per thread
+    if(running==nthreads) wait_one();
+
+    auto r = get_replica(i, inline_str(directory, "/branch", i));
+    make_directory(r.directory);
+
+    const pid_t pid = fork();
+    if(pid<0) throw inline_str("unable to fork branch ", i);
+    if(pid>0)
+    {
+      ++running;
+      continue;
+    }
+
+    // the child
+    try
+    {
+      // the openmp pool of the parent is not available after a fork
+#ifdef _OPENMP
+      omp_set_num_threads(1);
+#endif
+      nthreads = 1;
+
+      sim.set_kappa(replica_parameters(i).kappa);
+      sim.set_stream(i+1);
+      // report the collisions of this branch only
+      sim.get_grid().reset_balance();
+      unique_ptr<frame_publisher> publisher;
+      if(not shm.empty())
+      {
+        publisher.reset(new frame_publisher(inline_str(shm, ".", i), params, shm_slots));
+        r.publisher = publisher.get();
+      }
+      const double time = simulate(sim, r);
+      balance = sim.get_grid().get_balance();
+      ofstream file(inline_str(r.directory, "/summary"), ios::out);
+      write_summary(file, time);
+      file.close();
+    }
+    catch(const string& s) {
+      cerr << "branch " << i << ": " << s << endl;
+      _exit(1);
+    }
+    // do not run the destructors of the parent's state
+    cout.flush();
+    _exit(0);
+  }
+
+  while(running) wait_one();
+  return failed;
 }
 
 // =============================================================================
@@ -434,7 +490,49 @@ int main(int argc, char *argv[])
                      << endl << string(width, '=')
                      << endl;
 
-    init_random();
+    // set the number of threads
+#ifdef _OPENMP
+    if(nthreads>0) omp_set_num_threads(nthreads);
+    nthreads = omp_get_max_threads();
+#else
+    nthreads = 1;
+#endif
+
+    if(verbose) cout << "kernels: " << kernel_isa() << endl;
+
+    // run a sweep over the base runcard instead
+    if(not sweep_file.empty())
+    {
+      if(verbose) cout << endl << "Sweep" << endl << string(width, '=') << endl;
+      return sweep(directory, sweep_file, executable_path(argv[0]), nthreads) ? 1 : 0;
+    }
+
+    const auto init = chrono::steady_clock::now();
+    init_random(seed);
+    const double tables = chrono::duration<double>(chrono::steady_clock::now()
+                                                   - init).count();
+
+    // validate engines instead of running
+    if(validate_steps)
+    {
+      if(verbose) cout << endl << "Validation" << endl << string(width, '=') << endl;
+      return validate(params, validate_steps) ? 0 : 1;
+    }
+
+    // find the fastest tunables for this runcard on this node
+    if(autotuning)
+    {
+      if(verbose) cout << endl << "Autotuning" << endl << string(width, '=') << endl;
+      tuned = autotune(params, nthreads, default_tuning_cache(), verbose);
+      nthreads = tuned.threads;
+      if(verbose) cout << "tuning = " << describe(tuned) << endl;
+    }
+
+    // open counters on all threads
+    if(perf and not perf_init() and verbose)
+      cout << "warning: hardware counters unavailable" << endl;
+
+    if(trace) trace_init(trace_window[0], trace_window[1]);
 
     // ========================================
     // Running
@@ -442,7 +540,103 @@ int main(int argc, char *argv[])
     if(verbose) cout << endl << "Run" << endl << string(width, '=') << endl;
 
     // do the job
-    simulate();
+    double time;
+    if(nbranches)
+    {
+      const auto start = chrono::steady_clock::now();
+      simulation sim(params);
+      startup = tables + chrono::duration<double>(chrono::steady_clock::now()
+                                                  - start).count();
+      if(const int failed = branch(sim))
+        throw inline_str(failed, " branches failed");
+      balance = sim.get_grid().get_balance();
+      time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+    else if(nreplicas==1)
+    {
+      const auto start = chrono::steady_clock::now();
+      simulation sim(params);
+      startup = tables + chrono::duration<double>(chrono::steady_clock::now()
+                                                  - start).count();
+      if(autotuning) tuned.apply(sim);
+      auto r = get_replica(0, directory);
+      unique_ptr<frame_publisher> publisher;
+      if(not shm.empty())
+      {
+        publisher.reset(new frame_publisher(shm, params, shm_slots));
+        if(verbose) cout << "publishing frames to " << publisher->get_name() << endl;
+        r.publisher = publisher.get();
+      }
+      time = simulate(sim, r);
+      balance = sim.get_grid().get_balance();
+    }
+    else
+    {
+      // replicas share the parameters and the random tables, each one is
+      // run on a single thread with its own random stream and directory
+      vector<replica> replicas;
+      for(int i=0; i<nreplicas; ++i)
+      {
+        replicas.push_back(get_replica(i, inline_str(directory, "/replica", i)));
+        if(replicas.back().output) make_directory(replicas.back().directory);
+      }
+
+      // each replica publishes to its own shared memory object
+      vector<unique_ptr<frame_publisher>> publishers;
+      if(not shm.empty()) for(auto& r : replicas)
+      {
+        publishers.emplace_back(
+          new frame_publisher(inline_str(shm, ".", r.index), params, shm_slots));
+        r.publisher = publishers.back().get();
+      }
+
+      // exceptions can not leave the parallel region: the first one is kept
+      // and thrown again afterwards
+      exception_ptr error;
+
+      const auto start = chrono::steady_clock::now();
+#pragma omp parallel for schedule(dynamic, 1)
+      for(int i=0; i<nreplicas; ++i)
+      {
+        try
+        {
+          const auto created = chrono::steady_clock::now();
+          simulation sim(replica_parameters(i), i);
+          const double t = chrono::duration<double>(chrono::steady_clock::now()
+                                                    - created).count();
+          simulate(sim, replicas[i]);
+#pragma omp critical
+          {
+            balance += sim.get_grid().get_balance();
+            startup = max(startup, tables + t);
+          }
+        }
+        catch(...)
+        {
+#pragma omp critical
+          if(not error) error = current_exception();
+        }
+      }
+      if(error) rethrow_exception(error);
+      time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+
+    // ========================================
+    // Summary
+
+    if(verbose)
+    {
+      cout << endl << "Summary" << endl << string(width, '=') << endl;
+      write_summary(cout, time);
+    }
+
+    // write alongside the frames
+    {
+      ofstream file(inline_str(directory, "/summary"), ios::out);
+      write_summary(file, time);
+    }
+
+    if(trace) trace_dump(inline_str(directory, "/trace.json"));
   }
   // error messages
   catch(const string& s) {
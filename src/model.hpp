@@ -0,0 +1,544 @@
+// model.hpp
+// particles, boxes and collision engines
+
+#ifndef MODEL_HPP_
+#define MODEL_HPP_
+
+#include <atomic>
+#include <initializer_list>
+#include "header.hpp"
+#include "random.hpp"
+#include "tools.hpp"
+#include "parameters.hpp"
+#include "trace.hpp"
+#include "dispatch.hpp"
+
+// single particle
+struct particle
+{
+  // current velocity and position
+  vec x, v;
+  // particle type
+  int t;
+
+  // one step forward
+  void stream(const parameters& params)
+  {
+    for(int i=0; i<dim; ++i)
+      x[i] = modu(x[i] + params.tau*v[i], params.L[i]);
+  }
+};
+
+// particles of a box (a range of a particle list of the grid)
+struct particle_list
+{
+  particle* const* first;
+  particle* const* last;
+
+  particle* const* begin() const { return first; }
+  particle* const* end() const { return last; }
+  std::size_t size() const { return last-first; }
+  particle* operator[](std::size_t k) const { return first[k]; }
+};
+
+/** Box used for collision operation
+ *
+ * The state of the boxes is stored by the grid as contiguous fields (see
+ * box_state): a box only refers to the entries of one of them.
+ * */
+struct box
+{
+  // location of the center of the box
+  const vec x;
+  // number of particles of each type
+  const int* const n;
+  // ptrs to particles
+  const particle_list particles;
+  // mean velocity
+  vec& vcm;
+  // total ekin
+  float& ekin;
+
+  // the collision operator (the parameters must be prepared)
+  void collision(const vec& shift, const parameters& params)
+  {
+    const int ntypes = params.ntypes;
+
+    // compute box properties
+    std::vector<vec> grad (ntypes+1, {{0,0}});
+    //vector<vec> grad2(ntypes, {{0,0}});
+    std::vector<int> ngrad(ntypes, 0);
+    //int ngrad = 0;
+    vec ncm = {{ 0, 0 }};
+    vcm = {{ 0, 0 }};
+    for(const auto& p : particles)
+    {
+      // gradient
+      const vec d = modu(p->x + shift, params.L) - x;
+      if(d.sq()<.25f)
+      {
+        grad[p->t] += 12.f*d;
+        //grad2[p->t] += 480.f*d*(26.f*d*d + 6.f - 35.f*d.times(d));
+        ++ngrad[p->t];
+      }
+
+      // noise
+      vcm  += p->v;
+      p->v  = {{ random_normal(), random_normal() }};
+      ncm  += p->v;
+    }
+
+    normalize(vcm, particles.size());
+    normalize(ncm, particles.size());
+    for(int t=0; t<ntypes; ++t)
+    {
+      normalize(grad[t], ngrad[t]);
+      grad[ntypes] += grad[t]; // total grad
+    }
+
+    // kick of each type in this box: coupling to the gradient of each type
+    // per particle of the type and per particle in the box
+    std::vector<vec> kick(ntypes, {{0,0}});
+    for(int a=0; a<ntypes; ++a)
+      if(n[a])
+        for(int b : params.partners[a])
+          kick[a] += params.coupling[a*ntypes+b]/n[a]/particles.size()*grad[b];
+
+    // perform collision
+    ekin = 0;
+    vec vcm_corr = {{0,0}};
+    const vec dv = vcm - ncm;
+    for(const auto& p : particles)
+    {
+      p->v += dv + kick[p->t];
+
+      vcm_corr += p->v;
+      ekin += p->v.sq()/2;
+    }
+
+    // correct for momentum conservation
+    normalize(vcm_corr, particles.size());
+    for(const auto& p: particles)
+      p->v -= vcm_corr - vcm;
+  }
+};
+
+/** State of all boxes
+ *
+ * Stored as contiguous fields indexed by the box (k = i*Ly + j, the same
+ * row major order as the frames) such that the output and the analysis use
+ * them directly. The particles are stored in one list per tile of rows of
+ * boxes (see grid), box k holding first[k][0] to first[k][count[k]-1], and
+ * the centers of the boxes are computed from their index.
+ * */
+struct box_state
+{
+  // number of types and of boxes in each dimension
+  int ntypes;
+  std::vector<int> L;
+  // number of particles of each type, stored as [box][type]
+  std::vector<int, default_init_allocator<int>> n;
+  // mean velocity and total kinetic energy of each box
+  std::vector<vec, default_init_allocator<vec>> vcm;
+  std::vector<float, default_init_allocator<float>> ekin;
+  // particles of each tile, first particle and number of particles of each
+  // box
+  std::vector<std::vector<particle*>> lists;
+  std::vector<particle**, default_init_allocator<particle**>> first;
+  std::vector<unsigned, default_init_allocator<unsigned>> count;
+
+  // number of boxes
+  std::size_t size() const
+  { return vcm.size(); }
+
+  // number of particles in box k
+  std::size_t occupancy(std::size_t k) const
+  { return count[k]; }
+
+  // center of box k
+  vec center(std::size_t k) const
+  { return {{ k/L[1] + .5f, k%L[1] + .5f }}; }
+
+  // box k
+  box operator[](std::size_t k)
+  {
+    return { center(k), &n[k*ntypes], { first[k], first[k] + count[k] },
+             vcm[k], ekin[k] };
+  }
+};
+
+/** Collision kernel applied to a range of boxes
+ *
+ * Takes the boxes [first, last) of the state, the current grid shift and the
+ * parameters of the system. All engines must conserve the number of
+ * particles and the momentum of each box and reproduce the statistics of the
+ * reference implementation (box::collision), see validate.cpp.
+ * */
+using collision_kernel = void (*)(box_state&, std::size_t first, std::size_t last,
+                                  const vec&, const parameters&);
+
+// return the kernel of a given engine (throws if unknown)
+collision_kernel get_engine(const std::string& name);
+// names of all available engines
+std::vector<std::string> engine_names();
+// does the engine implement the reference collision operator? (otherwise it
+// only shares its conservation laws, e.g. srd)
+bool reference_operator(const std::string& name);
+
+// statistics of the load balance of the collision
+struct load_balance
+{
+  // number of collisions
+  long steps = 0;
+  // sums over all collisions of the mean and max busy time of the threads
+  double mean = 0, max = 0;
+  // number of chunks processed and stolen from other threads
+  long chunks = 0, stolen = 0;
+
+  // mean fraction of time the threads are busy (1 is perfect balance)
+  double efficiency() const
+  { return max>0 ? mean/max : 1; }
+
+  load_balance& operator+=(const load_balance& b)
+  {
+    steps += b.steps; mean += b.mean; max += b.max;
+    chunks += b.chunks; stolen += b.stolen;
+    return *this;
+  }
+};
+
+// global quantities of the boxes after a collision
+struct totals
+{
+  // total momentum
+  std::array<double, dim> momentum;
+  // total kinetic energy
+  double ekin;
+  // number of particles of each type
+  std::vector<std::int64_t> counts;
+
+  totals(int ntypes = 0)
+    : ekin(0), counts(ntypes, 0)
+  { momentum.fill(0.); }
+
+  // add the quantities of box k
+  void add(const box_state& b, std::size_t k)
+  {
+    for(int i=0; i<dim; ++i) momentum[i] += double(b.occupancy(k))*b.vcm[k][i];
+    ekin += b.ekin[k];
+    for(int t=0; t<b.ntypes; ++t) counts[t] += b.n[k*b.ntypes+t];
+  }
+
+  totals& operator+=(const totals& t)
+  {
+    for(int i=0; i<dim; ++i) momentum[i] += t.momentum[i];
+    ekin += t.ekin;
+    for(size_t k=0; k<counts.size(); ++k) counts[k] += t.counts[k];
+    return *this;
+  }
+};
+
+// storage of the particles (not touched before they are created)
+using particle_store = std::vector<particle, default_init_allocator<particle>>;
+
+// set of boxes
+class grid
+{
+  // all boxes
+  box_state boxes;
+  // the current grid shift
+  vec shift;
+  // number of boxes in each dimension
+  std::vector<int> L;
+
+  // chunks of the collision are the boxes [chunks[c], chunks[c+1])
+  std::vector<std::size_t> chunks;
+  // the chunks owned by a thread, claimed by the owner and thieves alike
+  struct chunk_queue
+  {
+    std::atomic<int> next;
+    int last;
+    // one queue per cache line
+    char padding[64-sizeof(std::atomic<int>)-sizeof(int)];
+  };
+  std::vector<chunk_queue> queues;
+  // number of chunks of each thread (more chunks leave more to steal)
+  int chunks_per_thread = 4;
+  // statistics
+  load_balance balance;
+  // totals of each chunk and of the last collision
+  std::vector<totals> chunk_totals;
+  totals sums;
+
+  // particles owned by the cells of the unshifted lattice, kept from one
+  // step to the next in a single list per tile holding its cells one after
+  // the other (same order as the boxes)
+  std::vector<std::vector<particle*>> owners;
+  // the particles of a cell are sorted by the quadrant of the cell they lie
+  // in after the shift (i.e. by the box they belong to), this is the end of
+  // the quadrants 0 to 3 of each cell in the list of its tile (the cell
+  // starts where the previous one ends)
+  std::vector<std::array<unsigned, 4>> quadrants;
+  // have the particles been assigned to the owner cells?
+  bool owned = false;
+  // particles that entered the cells of each tile (when not fused)
+  std::vector<std::vector<particle*>> migrants;
+  // number of particles migrated so far
+  std::int64_t migrations = 0;
+  // rebuild the boxes from scratch instead of migrating
+  bool rebuild = false;
+
+  // the boxes and the owner cells are split in tiles of tile_rows rows,
+  // each tile having its own list of particles
+  int tile_rows;
+  // do the time steps tile by tile when possible
+  bool fused = true;
+  // largest velocity across the rows after the last collision (negative if
+  // not known)
+  float vmax = -1;
+  // particles that left a tile during the streaming, going to the previous,
+  // same and next tiles
+  std::vector<std::array<std::vector<particle*>, 3>> outbox;
+  // totals, largest velocity across the rows and number of migrations of
+  // each tile during the last fused step
+  std::vector<totals> tile_totals;
+  std::vector<float> tile_vmax;
+  std::vector<std::int64_t> tile_migrations;
+
+  // number of tiles
+  int ntiles() const
+  { return (L[0] + tile_rows - 1)/tile_rows; }
+  // boxes (and owner cells) [first, last) of a tile
+  std::size_t tile_begin(int b) const
+  { return std::size_t(b*tile_rows)*L[1]; }
+  std::size_t tile_end(int b) const
+  { return std::size_t(std::min((b+1)*tile_rows, L[0]))*L[1]; }
+  // tile of a box (or owner cell)
+  int tile(std::size_t c) const
+  { return c/(std::size_t(tile_rows)*L[1]); }
+  // start of an owner cell in the list of its tile
+  unsigned cell_begin(std::size_t c) const
+  { return c%(std::size_t(tile_rows)*L[1]) ? quadrants[c-1][3] : 0; }
+
+  // coordinate of the owner cell of a particle in a given dimension
+  int cell(const particle* p, int i) const
+  {
+    return std::min(int(p->x[i]), L[i]-1);
+  }
+
+  // index of the owner cell of a particle
+  std::size_t owner(const particle* p) const
+  {
+    std::size_t index = 0;
+    for(int i=0; i<dim; ++i)
+      index = L[i]*index + cell(p, i);
+    return index;
+  }
+
+  // quadrant of a particle within its owner cell (a, b), i.e. which of the
+  // four boxes overlapping the cell it belongs to
+  unsigned quadrant(const particle* p, int a, int b) const
+  {
+    return 2*(p->x[0]>=a+1-shift[0]) + (p->x[1]>=b+1-shift[1]);
+  }
+
+  // assign all particles to their owner cell
+  void assign(particle_store& particles);
+  // sort the particles of each cell by quadrant and move the particles that
+  // left their cell to their new one
+  void migrate();
+  // remove the particles that left the cells of a tile (appended to out) and
+  // sort the others by quadrant
+  void sort_tile(int b, std::vector<particle*>& out);
+  // insert particles in the owner cells of a tile, at the end of their
+  // quadrant and in the order of the lists
+  void insert_tile(int b,
+                   std::initializer_list<const std::vector<particle*>*> lists);
+  // call f(list, first, last) for the particles list[first, last) of the
+  // owner cells that belong to box k
+  template<class F>
+  void overlapping(std::size_t k, F f) const;
+  // fill the boxes with the quadrants of the owner cells they overlap
+  void assemble();
+  // fill the boxes of a tile
+  void gather(int b);
+  // index of the box of a particle for the current shift
+  std::size_t index(const particle* p) const
+  {
+    std::size_t index = 0;
+    for(int i=0; i<dim; ++i)
+      index = L[i]*index + int(modu(p->x[i]+shift[i], L[i]));
+    return index;
+  }
+  // bucket all particles from scratch
+  void rebucket(particle_store& particles);
+
+  // stream the particles owned by a tile and sort its cells, the particles
+  // that left their cell go to the outbox of the tile
+  void stream_tile(int b, const parameters& params);
+  // insert the particles that entered the cells of a tile from the outboxes
+  void receive_tile(int b);
+  // collide the boxes of a tile
+  void collide_tile(int b, collision_kernel kernel, const parameters& params);
+
+  // split the boxes in chunks of equal cost for a given number of threads
+  void partition(int nthreads);
+
+public:
+  // number of rows of the tiles: about 16k particles such that the particles
+  // and the lists of a few tiles stay in cache (but at least two rows such
+  // that the particles seldom cross more than one tile), the last tile
+  // holding the remaining rows
+  static int tile_height(const parameters& params)
+  {
+    const int mean = std::accumulate(params.dens.begin(), params.dens.end(), 0);
+    const int rows = 16384/std::max(1, params.L[1]*mean);
+    return std::max(2, std::min(params.L[0], rows));
+  }
+
+  grid(const parameters& params)
+    : L(params.L)
+  {
+    const std::size_t nboxes = params.nboxes();
+    boxes.ntypes = params.ntypes;
+    boxes.L = L;
+    boxes.n.resize(nboxes*params.ntypes);
+    boxes.vcm.resize(nboxes);
+    boxes.ekin.resize(nboxes);
+    boxes.first.resize(nboxes);
+    boxes.count.resize(nboxes);
+
+    tile_rows = tile_height(params);
+    boxes.lists.resize(ntiles());
+    outbox.resize(ntiles());
+    tile_totals.resize(ntiles());
+    tile_vmax.resize(ntiles());
+    tile_migrations.resize(ntiles());
+
+    // initialize the fields and the owner cells in parallel such that they
+    // are first touched by the threads doing the collision (the particle
+    // lists are first touched when the particles are assigned and the boxes
+    // assembled)
+    owners.resize(ntiles());
+    migrants.resize(ntiles());
+    quadrants.resize(nboxes);
+#pragma omp parallel for schedule(static)
+    for(size_t k=0; k<nboxes; ++k)
+    {
+      std::fill_n(&boxes.n[k*params.ntypes], params.ntypes, 0);
+      boxes.vcm[k] = {{ 0, 0 }};
+      boxes.ekin[k] = 0;
+      boxes.first[k] = nullptr;
+      boxes.count[k] = 0;
+      quadrants[k] = {{ 0, 0, 0, 0 }};
+    }
+  }
+
+  void set_shift(const vec& s)
+  {
+    shift = s;
+  }
+
+  const vec& get_shift() const
+  { return shift; }
+
+  /** Assign the particles to the boxes for the current shift
+   *
+   * Every particle is owned by the cell of the unshifted lattice it lies in,
+   * and the owner cells are kept between calls: only the particles that
+   * crossed a cell face since the last call are moved (the first call
+   * assigns all particles). Each shifted box is then assembled in parallel
+   * from the 2^dim owner cells it overlaps. The particles must not be
+   * reallocated between calls.
+   *
+   * If rebuilding is set instead, all particles are bucketed from scratch
+   * (serially, but reading the particles in order) which can be faster with
+   * few threads.
+   * */
+  void update(particle_store& particles);
+
+  // bucketing strategy (see update)
+  void set_rebuild(bool r)
+  { rebuild = r; }
+  bool get_rebuild() const
+  { return rebuild; }
+
+  // do the time steps tile by tile when possible (see step)
+  void set_fused(bool f)
+  { fused = f; }
+  bool get_fused() const
+  { return fused; }
+  // the velocities were changed from outside (see can_fuse)
+  void forget_vmax()
+  { vmax = -1; }
+
+  /** Can the next time step be done tile by tile?
+   *
+   * Not when rebuilding, with fewer than 4 tiles or if a particle can move
+   * by more than the height of the shortest tile (the last one) while
+   * streaming (the tiles only exchange particles with their neighbours).
+   * The velocities are only read if not known from the last collision or
+   * if they were changed since (see forget_vmax).
+   * */
+  bool can_fuse(const particle_store& particles, const parameters& params);
+
+  /** Stream, bucket and collide all particles tile by tile
+   *
+   * The three passes over all particles are fused: each tile streams the
+   * particles of its owner cells and sorts them, receives the particles
+   * that crossed from its neighbours, then gathers and collides its boxes
+   * while the particles are still in cache. The steps of all tiles form a
+   * task graph (the boxes of a tile overlap the cells of the previous tile)
+   * that is run by the threads as the dependencies are met. The tasks are
+   * created along the tiles such that a single thread also runs them in a
+   * cache friendly order. See can_fuse for when this is possible.
+   * */
+  void step(particle_store& particles, collision_kernel kernel,
+            const parameters& params);
+
+  // number of collision chunks of each thread
+  void set_chunks_per_thread(int n)
+  { chunks_per_thread = std::max(1, n); }
+  int get_chunks_per_thread() const
+  { return chunks_per_thread; }
+
+  // number of particles that changed cell so far
+  std::int64_t get_migrations() const
+  { return migrations; }
+
+  /** Apply the collision kernel to all boxes
+   *
+   * The cost of a box grows with its occupancy, which varies widely in
+   * phase-separated states: the boxes are split into contiguous chunks of
+   * equal cost (known after bucketing) that are distributed evenly over the
+   * threads, and threads that run out of work steal chunks from the others.
+   *
+   * The global totals are reduced in the same pass, per chunk and then in
+   * the order of the chunks such that they do not depend on the stealing.
+   * */
+  void collision(collision_kernel kernel, const parameters& params);
+
+  // momentum, kinetic energy and counts after the last collision
+  const totals& get_totals() const
+  { return sums; }
+
+  // statistics of the load balance of all collisions so far
+  const load_balance& get_balance() const
+  { return balance; }
+  // forget the statistics (e.g. after an equilibration)
+  void reset_balance()
+  { balance = load_balance(); }
+
+  // state of the boxes after the last collision
+  const box_state& get_boxes() const
+  { return boxes; }
+};
+
+// stream the particles [first, last)
+void stream_particles(particle* first, particle* last, const parameters& params);
+
+// create all particles at random positions with thermal velocities at unit
+// temperature and zero total momentum (in parallel)
+particle_store create_particles(const parameters& params);
+
+#endif//MODEL_HPP_
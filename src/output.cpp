@@ -0,0 +1,182 @@
+//
+// reduction and writing of the frames
+//
+
+#include <cctype>
+#include <fstream>
+#include "output.hpp"
+#include "tools.hpp"
+
+using namespace std;
+
+const char* field_names[nfields] =
+{
+  "density",
+  "velocity",
+  "energy",
+  "species"
+};
+
+namespace
+{
+  // region and blocks of a reduced field
+  struct extent
+  {
+    int x0, y0, x1, y1;
+    // size of the blocks and number of blocks in each dimension
+    int b, nx, ny;
+  };
+
+  extent get_extent(const parameters& params, const output_options& options, int f)
+  {
+    extent e;
+    e.x0 = options.lower(params, 0);
+    e.y0 = options.lower(params, 1);
+    e.x1 = options.upper(params, 0);
+    e.y1 = options.upper(params, 1);
+    e.b  = options.block[f];
+    e.nx = (e.x1-e.x0+e.b-1)/e.b;
+    e.ny = (e.y1-e.y0+e.b-1)/e.b;
+    return e;
+  }
+
+  // fold every box of each block into a single value (in parallel over the
+  // blocks), the result is in row major order as the full frames
+  template<class T, class Fold>
+  vector<T> reduce(int Ly, const extent& e, T zero, Fold fold)
+  {
+    vector<T> values(size_t(e.nx)*e.ny, zero);
+
+#pragma omp parallel for schedule(static)
+    for(int a=0; a<e.nx; ++a)
+      for(int c=0; c<e.ny; ++c)
+      {
+        auto& value = values[size_t(a)*e.ny+c];
+        for(int i=e.x0+a*e.b; i<min(e.x0+(a+1)*e.b, e.x1); ++i)
+          for(int j=e.y0+c*e.b; j<min(e.y0+(c+1)*e.b, e.y1); ++j)
+            fold(value, size_t(i)*Ly+j);
+      }
+
+    return values;
+  }
+
+  // write a reduced field at once
+  template<class T>
+  void write_field(const string& fname, const vector<T>& values)
+  {
+    ofstream file(fname, ios::out | ios::binary);
+    file.write(reinterpret_cast<const char*>(values.data()), values.size()*sizeof(T));
+    if(not file.good()) throw inline_str("unable to write file ", fname);
+  }
+} // namespace
+
+void output_options::set_fields(const string& names)
+{
+  enabled.fill(false);
+
+  string name;
+  for(size_t k=0; k<=names.size(); ++k)
+  {
+    if(k<names.size() and (isalnum(names[k]) or names[k]=='_'))
+    {
+      name += names[k];
+      continue;
+    }
+    if(name.empty()) continue;
+
+    const auto f = find(begin(field_names), end(field_names), name);
+    if(f==end(field_names)) throw inline_str("unknown output field ", name);
+    enabled[f-begin(field_names)] = true;
+    name.clear();
+  }
+}
+
+void output_options::check(const parameters& params) const
+{
+  for(int f=0; f<nfields; ++f)
+    if(block[f]<1)
+      throw inline_str("coarse graining of ", field_names[f], " must be positive");
+
+  if(region.empty()) return;
+  if(region.size()!=2*size_t(dim))
+    throw inline_str("region of interest must be given as [x0, y0, x1, y1]");
+  for(int i=0; i<dim; ++i)
+    if(region[i]<0 or region[i]>=region[dim+i] or region[dim+i]>params.L[i])
+      throw inline_str("region of interest is empty or outside of the system");
+}
+
+int output_options::lower(const parameters& params, int i) const
+{
+  return region.empty() ? 0 : region[i];
+}
+
+int output_options::upper(const parameters& params, int i) const
+{
+  return region.empty() ? params.L[i] : region[dim+i];
+}
+
+void write_layout(const string& dir, const parameters& params,
+                  const output_options& options)
+{
+  ofstream file(inline_str(dir, "/frames"), ios::out);
+  if(not file.good()) throw inline_str("unable to write the layout of the frames");
+
+  file << "# field x0 y0 x1 y1 block nx ny" << endl;
+  for(int f=0; f<nfields; ++f)
+  {
+    if(not options.enabled[f]) continue;
+    const auto e = get_extent(params, options, f);
+    file << field_names[f] << " " << e.x0 << " " << e.y0 << " " << e.x1 << " "
+         << e.y1 << " " << e.b << " " << e.nx << " " << e.ny << endl;
+  }
+}
+
+void write_frame(const string& dir, int t, const grid& boxes,
+                 const parameters& params, const output_options& options)
+{
+  const int Ly = params.L[1];
+  const auto& b = boxes.get_boxes();
+
+  // helper to construct file names
+  const auto fname = [&](const string& s) {
+    return inline_str(dir, "/frame", t, ".", s, ".dat");
+  };
+
+  if(options.enabled[field_density])
+  {
+    const auto e = get_extent(params, options, field_density);
+    write_field(fname("density"), reduce(Ly, e, size_t(0),
+      [&b](size_t& n, size_t k) { n += b.occupancy(k); }));
+  }
+
+  if(options.enabled[field_velocity])
+  {
+    // velocity of the center of mass of each block
+    const auto e = get_extent(params, options, field_velocity);
+    const auto momentum = reduce(Ly, e, make_pair(vec(0.f), size_t(0)),
+      [&b](pair<vec, size_t>& m, size_t k) {
+        m.first += float(b.occupancy(k))*b.vcm[k];
+        m.second += b.occupancy(k);
+      });
+    vector<vec> velocity(momentum.size(), vec(0.f));
+    for(size_t k=0; k<momentum.size(); ++k)
+      if(momentum[k].second)
+        (velocity[k] = momentum[k].first) /= float(momentum[k].second);
+    write_field(fname("velocity"), velocity);
+  }
+
+  if(options.enabled[field_energy])
+  {
+    const auto e = get_extent(params, options, field_energy);
+    write_field(fname("energy"), reduce(Ly, e, 0.f,
+      [&b](float& ekin, size_t k) { ekin += b.ekin[k]; }));
+  }
+
+  if(options.enabled[field_species])
+  {
+    const auto e = get_extent(params, options, field_species);
+    for(int s=0; s<params.ntypes; ++s)
+      write_field(fname(inline_str("density.", s)), reduce(Ly, e, 0,
+        [&b, s](int& n, size_t k) { n += b.n[k*b.ntypes+s]; }));
+  }
+}
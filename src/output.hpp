@@ -0,0 +1,62 @@
+// output.hpp
+// reduction and writing of the frames
+
+#ifndef OUTPUT_HPP_
+#define OUTPUT_HPP_
+
+#include <array>
+#include <string>
+#include <vector>
+#include "model.hpp"
+
+// the different fields of a frame
+enum field
+{
+  field_density,
+  field_velocity,
+  field_energy,
+  field_species,
+  nfields
+};
+
+// human readable names of the fields
+extern const char* field_names[nfields];
+
+/** Reduction of the frames before they are written
+ *
+ * Every field is restricted to the region of interest and then coarse-grained
+ * over blocks of block x block boxes (the last row and column of blocks may
+ * be incomplete). The reduction keeps the meaning of each field: the number
+ * of particles and the kinetic energy of a block are the sums over its boxes
+ * while the velocity is the velocity of the center of mass of the block.
+ * */
+struct output_options
+{
+  // write each field?
+  std::array<bool, nfields> enabled = {{ true, true, true, true }};
+  // size of the blocks of each field (1 is no coarse graining)
+  std::array<int, nfields> block = {{ 1, 1, 1, 1 }};
+  // region of interest {x0, y0, x1, y1} in boxes, upper bounds excluded
+  // (empty is the full system)
+  std::vector<int> region;
+
+  // enable only the fields in a list of names, e.g. '[velocity, species]'
+  void set_fields(const std::string& names);
+
+  // check consistency with the system (throws a string on error)
+  void check(const parameters& params) const;
+
+  // bounds of the region of interest in a given dimension
+  int lower(const parameters& params, int i) const;
+  int upper(const parameters& params, int i) const;
+};
+
+// describe the layout of the frames in dir/frames
+void write_layout(const std::string& dir, const parameters& params,
+                  const output_options& options);
+
+// reduce and write the current state of the boxes
+void write_frame(const std::string& dir, int t, const grid& boxes,
+                 const parameters& params, const output_options& options);
+
+#endif//OUTPUT_HPP_
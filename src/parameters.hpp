@@ -0,0 +1,75 @@
+// parameters.hpp
+// physical parameters of a system
+
+#ifndef PARAMETERS_HPP_
+#define PARAMETERS_HPP_
+
+#include <cstdint>
+#include <functional>
+#include <numeric>
+#include <string>
+#include <vector>
+
+struct parameters
+{
+  // time step
+  float tau = 2e-2;
+  // number of boxes in each dimension
+  std::vector<int> L;
+  // number of particles per box of each type
+  std::vector<int> dens = {10};
+  // number of types
+  int ntypes = 1;
+  // interaction parameters (the interaction of two types is their product,
+  // each type is driven along its own gradient by its total interaction)
+  std::vector<float> kappa;
+  // symmetric interaction matrix, ntypes x ntypes in row major order (if
+  // empty the matrix is constructed from kappa), each type a is driven along
+  // the gradient of each type b by M[a][b]
+  std::vector<float> M;
+  // collision engine
+  std::string engine = "reference";
+  // rotation angle of the srd engine (degrees)
+  float angle = 130;
+  // thermostat of the srd engine
+  bool thermostat = false;
+
+  // total number of boxes
+  std::int64_t nboxes() const
+  {
+    return std::accumulate(L.begin(), L.end(), std::int64_t(1),
+                           std::multiplies<std::int64_t>());
+  }
+
+  // number of particles of a given type
+  std::int64_t npart(int t) const
+  {
+    return nboxes()*dens[t];
+  }
+
+  // total number of particles
+  std::int64_t ntot() const
+  {
+    return nboxes()*std::accumulate(dens.begin(), dens.end(), std::int64_t(0));
+  }
+
+  // interaction between two types
+  float interaction(int a, int b) const
+  {
+    return M.empty() ? kappa[a]*kappa[b] : M[a*ntypes+b];
+  }
+
+  // check consistency (throws a string on error)
+  void check() const;
+
+  // check and compute the derived quantities below
+  void prepare();
+
+  // coupling of the kick of each type to the gradient of each type, ntypes x
+  // ntypes in row major order (derived, diagonal with kappa and M otherwise)
+  std::vector<float> coupling;
+  // types with a non zero coupling to each type, in increasing order (derived)
+  std::vector<std::vector<int>> partners;
+};
+
+#endif//PARAMETERS_HPP_
@@ -0,0 +1,210 @@
+//
+// hardware performance counters
+//
+
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include "perf.hpp"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+const char* phase_names[nphases] =
+  { "stream", "bucket", "collision", "fused", "analysis", "output" };
+
+namespace
+{
+  // number of hardware counters
+  constexpr int ncounters = 4;
+  // names of the counters
+  const char* counter_names[ncounters] =
+    { "cycles", "instructions", "llc-misses", "branch-misses" };
+
+  // are we recording at all?
+  bool enabled = false;
+  // are the hardware counters available?
+  bool hardware = false;
+  // file descriptors of the counters of each thread
+  vector<vector<int>> fds;
+
+  // accumulated values for each phase
+  struct phase_stats
+  {
+    // number of times the phase was entered
+    unsigned long calls = 0;
+    // wall clock time
+    double seconds = 0;
+    // counter values
+    unsigned long long counts[ncounters] = { 0, 0, 0, 0 };
+
+    // values at the beginning of the phase
+    chrono::steady_clock::time_point start_time;
+    unsigned long long start[ncounters];
+  };
+
+  phase_stats stats[nphases];
+
+  // read the current value of all counters, summed over all threads
+  void read_counters(unsigned long long* values)
+  {
+    for(int i=0; i<ncounters; ++i) values[i] = 0;
+
+#ifdef __linux__
+    for(const auto& f : fds)
+      for(int i=0; i<ncounters; ++i)
+      {
+        unsigned long long v;
+        if(read(f[i], &v, sizeof(v))==sizeof(v)) values[i] += v;
+      }
+#endif
+  }
+
+#ifdef __linux__
+  // open a single counter for the calling thread (user space only)
+  int open_counter(uint32_t type, uint64_t config)
+  {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+#endif
+
+  // phases are only timed from outside of parallel regions
+  inline bool in_parallel()
+  {
+#ifdef _OPENMP
+    return omp_in_parallel();
+#else
+    return false;
+#endif
+  }
+} // namespace
+
+bool perf_init()
+{
+  enabled = true;
+
+#ifdef __linux__
+  hardware = true;
+
+  // open the counters on every thread of the pool
+#pragma omp parallel
+  {
+    vector<int> f(ncounters);
+    f[0] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    f[1] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    f[2] = open_counter(PERF_TYPE_HW_CACHE,
+                        PERF_COUNT_HW_CACHE_LL
+                        | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                        | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    // not all cpus expose the LLC event: fall back to the generic one
+    if(f[2]<0)
+      f[2] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    f[3] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+
+#pragma omp critical
+    {
+      for(const auto& fd : f) hardware &= fd>=0;
+      fds.push_back(f);
+    }
+  }
+
+  for(const auto& f : fds)
+    for(const auto& fd : f)
+      if(hardware)
+      {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+      }
+      else if(fd>=0) close(fd);
+
+  if(not hardware) fds.clear();
+#endif
+
+  return hardware;
+}
+
+bool perf_enabled()
+{
+  return enabled;
+}
+
+void perf_begin(phase p)
+{
+  if(not enabled or in_parallel()) return;
+
+  auto& s = stats[p];
+  if(hardware) read_counters(s.start);
+  s.start_time = chrono::steady_clock::now();
+}
+
+void perf_end(phase p)
+{
+  if(not enabled or in_parallel()) return;
+
+  auto& s = stats[p];
+  s.seconds += chrono::duration<double>(chrono::steady_clock::now()
+                                        - s.start_time).count();
+  ++s.calls;
+
+  if(hardware)
+  {
+    unsigned long long values[ncounters];
+    read_counters(values);
+    for(int i=0; i<ncounters; ++i) s.counts[i] += values[i] - s.start[i];
+  }
+}
+
+void perf_summary(ostream& stream)
+{
+  if(not enabled) return;
+
+  if(not hardware)
+    stream << "hardware counters unavailable (see perf_event_paranoid), "
+           << "reporting wall clock only" << endl;
+
+  // header
+  stream << left << setw(12) << "phase" << right
+         << setw(10) << "calls" << setw(12) << "time [s]";
+  if(hardware)
+  {
+    for(const auto& n : counter_names) stream << setw(16) << n;
+    stream << setw(8) << "ipc";
+  }
+  stream << endl;
+
+  // values
+  for(int p=0; p<nphases; ++p)
+  {
+    const auto& s = stats[p];
+    stream << left << setw(12) << phase_names[p] << right
+           << setw(10) << s.calls
+           << setw(12) << fixed << setprecision(3) << s.seconds;
+    if(hardware)
+    {
+      for(const auto& c : s.counts) stream << setw(16) << c;
+      stream << setw(8) << setprecision(2)
+             << double(s.counts[1])/(s.counts[0] + (s.counts[0]==0));
+    }
+    stream << defaultfloat << endl;
+  }
+}
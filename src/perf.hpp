@@ -0,0 +1,33 @@
+// perf.hpp
+// hardware performance counters per simulation phase
+
+#ifndef PERF_HPP_
+#define PERF_HPP_
+
+#include <iostream>
+#include "phase.hpp"
+
+/** Open the hardware counters for the calling process
+ *
+ * Uses the Linux perf_event_open syscall to count cycles, instructions, LLC
+ * misses and branch misses in user space only (such that no special
+ * privileges are required). Returns false if the counters are not available,
+ * in which case only the wall clock time of each phase is recorded. Counters
+ * are opened on every thread of the OpenMP pool and summed, such that this
+ * must be called after the number of threads has been set.
+ * */
+bool perf_init();
+
+// are the phases being recorded? (the counters are summed over all threads
+// and can not be told apart within a tiled step, which is then not used)
+bool perf_enabled();
+
+// start counting for a given phase
+void perf_begin(phase p);
+// stop counting and accumulate for a given phase
+void perf_end(phase p);
+
+// write the aggregated counters for each phase
+void perf_summary(std::ostream& stream);
+
+#endif//PERF_HPP_
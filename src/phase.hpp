@@ -0,0 +1,46 @@
+// phase.hpp
+// the different phases of a time step
+
+#ifndef PHASE_HPP_
+#define PHASE_HPP_
+
+// the different phases of a time step
+enum phase
+{
+  phase_stream,
+  phase_bucket,
+  phase_collision,
+  phase_fused,
+  phase_analysis,
+  phase_output,
+  nphases
+};
+
+// human readable names of the phases
+extern const char* phase_names[nphases];
+
+// instrumentation hooks (see perf.hpp and trace.hpp)
+void perf_begin(phase p);
+void perf_end(phase p);
+void trace_begin(phase p);
+void trace_end(phase p);
+
+// instrument a phase for the lifetime of the object
+struct phase_scope
+{
+  const phase p;
+
+  phase_scope(phase p)
+    : p(p)
+  {
+    perf_begin(p);
+    trace_begin(p);
+  }
+  ~phase_scope()
+  {
+    trace_end(p);
+    perf_end(p);
+  }
+};
+
+#endif//PHASE_HPP_
@@ -0,0 +1,185 @@
+//
+// live frames in a shared memory ring buffer
+//
+
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "publish.hpp"
+
+using namespace std;
+
+namespace
+{
+  // shared memory names must start with a slash
+  string shm_name(const string& name)
+  {
+    return name.empty() or name[0]!='/' ? "/"+name : name;
+  }
+
+  // size of the data of a single frame
+  size_t frame_size(size_t ntypes, size_t nboxes)
+  {
+    return nboxes*(ntypes*sizeof(int32_t) + (dim+1)*sizeof(float));
+  }
+
+  // round up to a full cache line
+  size_t align(size_t n)
+  {
+    return (n+63)/64*64;
+  }
+
+  // slot of a given frame
+  char* get_slot(void* data, uint64_t frame)
+  {
+    const auto h = static_cast<frame_header*>(data);
+    return static_cast<char*>(data) + align(sizeof(frame_header))
+      + (frame-1)%h->nslots*h->slot_size;
+  }
+} // namespace
+
+frame_publisher::frame_publisher(const string& name_,
+                                 const parameters& params,
+                                 int nslots)
+  : name(shm_name(name_))
+{
+  if(nslots<2) throw inline_str("shared memory needs at least two slots");
+
+  const size_t nboxes = params.nboxes();
+  if(nboxes>UINT32_MAX) throw inline_str("too many boxes for shared memory frames");
+  const size_t slot_size = align(sizeof(frame_slot)
+                                 + frame_size(params.ntypes, nboxes));
+  size = align(sizeof(frame_header)) + nslots*slot_size;
+
+  // replace any leftover from a previous run
+  shm_unlink(name.c_str());
+  const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  if(fd<0) throw inline_str("unable to create shared memory ", name);
+  if(ftruncate(fd, size)!=0)
+  {
+    close(fd);
+    shm_unlink(name.c_str());
+    throw inline_str("unable to allocate shared memory ", name);
+  }
+  data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(data==MAP_FAILED)
+  {
+    shm_unlink(name.c_str());
+    throw inline_str("unable to map shared memory ", name);
+  }
+
+  // the segment is zero filled: all slots are empty
+  auto h = new (data) frame_header;
+  h->dim = dim;
+  h->ntypes = params.ntypes;
+  for(int i=0; i<4; ++i) h->L[i] = i<dim ? params.L[i] : 1;
+  h->nboxes = nboxes;
+  h->nslots = nslots;
+  h->slot_size = slot_size;
+  h->head.store(0, memory_order_relaxed);
+  for(int i=1; i<=nslots; ++i)
+    new (get_slot(data, i)) frame_slot;
+  // the magic number is written last such that readers see a complete header
+  atomic_thread_fence(memory_order_release);
+  h->magic = frame_magic;
+}
+
+frame_publisher::~frame_publisher()
+{
+  munmap(data, size);
+  shm_unlink(name.c_str());
+}
+
+void frame_publisher::publish(int time, const grid& boxes)
+{
+  const auto h = static_cast<frame_header*>(data);
+  const auto slot = get_slot(data, ++frame);
+  const auto s = reinterpret_cast<frame_slot*>(slot);
+  const size_t nboxes = h->nboxes;
+
+  // mark the slot as being written
+  s->sequence.store(2*frame-1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  s->time = time;
+  auto density = reinterpret_cast<int32_t*>(slot + sizeof(frame_slot));
+  auto vcm = reinterpret_cast<float*>(density + h->ntypes*nboxes);
+  auto ekin = vcm + dim*nboxes;
+
+  // the fields are contiguous, only the counts are transposed
+  const auto& b = boxes.get_boxes();
+  for(size_t k=0; k<nboxes; ++k)
+    for(size_t t=0; t<h->ntypes; ++t)
+      density[t*nboxes+k] = b.n[k*h->ntypes+t];
+  memcpy(vcm, b.vcm.data(), nboxes*sizeof(vec));
+  memcpy(ekin, b.ekin.data(), nboxes*sizeof(float));
+
+  s->sequence.store(2*frame, memory_order_release);
+  h->head.store(frame, memory_order_release);
+}
+
+frame_subscriber::frame_subscriber(const string& name)
+{
+  const int fd = shm_open(shm_name(name).c_str(), O_RDONLY, 0);
+  if(fd<0) throw inline_str("unable to open shared memory ", name);
+
+  // map the header first to get the full size
+  void* h = mmap(nullptr, sizeof(frame_header), PROT_READ, MAP_SHARED, fd, 0);
+  if(h==MAP_FAILED)
+  {
+    close(fd);
+    throw inline_str("unable to map shared memory ", name);
+  }
+  const auto header = static_cast<const frame_header*>(h);
+  const bool good = header->magic==frame_magic and header->dim==dim;
+  size = align(sizeof(frame_header)) + header->nslots*size_t(header->slot_size);
+  atomic_thread_fence(memory_order_acquire);
+  munmap(h, sizeof(frame_header));
+  if(not good)
+  {
+    close(fd);
+    throw inline_str("shared memory ", name, " does not contain frames");
+  }
+
+  data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(data==MAP_FAILED) throw inline_str("unable to map shared memory ", name);
+}
+
+frame_subscriber::~frame_subscriber()
+{
+  munmap(data, size);
+}
+
+bool frame_subscriber::latest(frame_view& view) const
+{
+  return get(get_header().head.load(memory_order_acquire), view);
+}
+
+bool frame_subscriber::get(uint64_t frame, frame_view& view) const
+{
+  if(frame==0) return false;
+
+  const auto& h = get_header();
+  const auto slot = get_slot(data, frame);
+  const auto s = reinterpret_cast<const frame_slot*>(slot);
+
+  view.sequence = s->sequence.load(memory_order_acquire);
+  if(view.sequence!=2*frame) return false;
+
+  view.time = s->time;
+  view.density = reinterpret_cast<const int32_t*>(slot + sizeof(frame_slot));
+  view.vcm = reinterpret_cast<const float*>(view.density + size_t(h.ntypes)*h.nboxes);
+  view.ekin = view.vcm + size_t(dim)*h.nboxes;
+  return valid(view);
+}
+
+bool frame_subscriber::valid(const frame_view& view) const
+{
+  const auto slot = get_slot(data, view.sequence/2);
+  atomic_thread_fence(memory_order_acquire);
+  return reinterpret_cast<const frame_slot*>(slot)->sequence
+    .load(memory_order_relaxed)==view.sequence;
+}
@@ -0,0 +1,129 @@
+// publish.hpp
+// live frames in a shared memory ring buffer
+
+#ifndef PUBLISH_HPP_
+#define PUBLISH_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include "model.hpp"
+
+static_assert(ATOMIC_LLONG_LOCK_FREE==2,
+              "shared memory frames require lock-free 64-bit atomics");
+
+/** Layout of the shared memory segment
+ *
+ * The segment starts with a frame_header followed by nslots slots of
+ * slot_size bytes each. Every slot starts with a frame_slot followed by the
+ * data of a single frame:
+ *
+ *   int32_t density[ntypes][nboxes]    number of particles of each type
+ *   float   vcm[nboxes][dim]           mean velocity
+ *   float   ekin[nboxes]               total kinetic energy
+ *
+ * with the boxes in the same order as in the frame files. Frame f (counting
+ * from 1) is written in slot (f-1)%nslots whose sequence number is 2f-1 while
+ * it is being written and 2f once complete, such that readers can detect torn
+ * frames without ever blocking the writer (seqlock).
+ * */
+struct frame_header
+{
+  // identifies the segment ("MPCDSHM1")
+  std::uint64_t magic;
+  // dimension of space and number of types
+  std::uint32_t dim, ntypes;
+  // system size (unused dimensions are 1)
+  std::uint32_t L[4];
+  // total number of boxes
+  std::uint32_t nboxes;
+  // number of slots and size of each slot in bytes
+  std::uint32_t nslots, slot_size;
+  // last complete frame (0 if none)
+  std::atomic<std::uint64_t> head;
+};
+
+struct frame_slot
+{
+  // sequence number (odd while being written)
+  std::atomic<std::uint64_t> sequence;
+  // time step of the frame
+  std::int64_t time;
+};
+
+// magic number of the segment
+constexpr std::uint64_t frame_magic = 0x314d48534443504dull;
+
+/** Publish frames to a shared memory ring buffer
+ *
+ * Creates (or replaces) the POSIX shared memory object with the given name
+ * and removes it on destruction. Publishing never waits for the readers: a
+ * slow reader simply misses frames.
+ * */
+class frame_publisher
+{
+  // name of the shared memory object
+  std::string name;
+  // the mapping
+  void* data = nullptr;
+  std::size_t size = 0;
+  // last frame published
+  std::uint64_t frame = 0;
+
+public:
+  frame_publisher(const std::string& name, const parameters& params, int nslots);
+  ~frame_publisher();
+
+  frame_publisher(const frame_publisher&) = delete;
+  frame_publisher& operator=(const frame_publisher&) = delete;
+
+  // write the current state of the boxes
+  void publish(int time, const grid& boxes);
+
+  // name of the shared memory object
+  const std::string& get_name() const
+  { return name; }
+};
+
+// a frame in shared memory (valid only as long as its sequence is unchanged)
+struct frame_view
+{
+  std::uint64_t sequence;
+  std::int64_t time;
+  const std::int32_t* density;
+  const float* vcm;
+  const float* ekin;
+};
+
+/** Read frames from a shared memory ring buffer
+ *
+ * Frames are accessed in place: get a view of the latest frame, use it and
+ * check that it is still valid, i.e. that it has not been overwritten by the
+ * publisher in the meantime.
+ * */
+class frame_subscriber
+{
+  void* data = nullptr;
+  std::size_t size = 0;
+
+public:
+  // attach to an existing segment (throws if unavailable)
+  frame_subscriber(const std::string& name);
+  ~frame_subscriber();
+
+  frame_subscriber(const frame_subscriber&) = delete;
+  frame_subscriber& operator=(const frame_subscriber&) = delete;
+
+  // description of the segment
+  const frame_header& get_header() const
+  { return *static_cast<const frame_header*>(data); }
+
+  // view of the latest complete frame, returns false if none
+  bool latest(frame_view& view) const;
+  // view of a given frame, returns false if not (or no longer) available
+  bool get(std::uint64_t frame, frame_view& view) const;
+  // is the frame still unmodified?
+  bool valid(const frame_view& view) const;
+};
+
+#endif//PUBLISH_HPP_
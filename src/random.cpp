@@ -1,25 +1,125 @@
 // random numbers
 
+#include <atomic>
 #include <random>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "random.hpp"
+#include "tools.hpp"
 #include "ziggurat_inline.hpp"
 
 using namespace std;
 
 // size of the random numbers tables
 constexpr int table_size = 16777216;
-// the tables
-vector<float> normal_values(table_size);
-vector<float> unifor_values(table_size);
+// the tables (not touched before init_random)
+vector<float, default_init_allocator<float>> normal_values(table_size);
+vector<float, default_init_allocator<float>> unifor_values(table_size);
+
+namespace
+{
+  // numbers read in a row from the tables before jumping
+  constexpr int block_length = 1024;
+
+  // seed of the tables
+  uint64_t table_seed = 0;
+  // have the tables been populated?
+  bool ready = false;
+
+  // splitmix64 finalizer
+  inline uint64_t mix(uint64_t z)
+  {
+    z += 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z>>30))*0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z>>27))*0x94d049bb133111ebull;
+    return z ^ (z>>31);
+  }
+
+  // identifies the sequence of a given thread on a given stream
+  inline uint64_t stream_key(unsigned stream, int thread)
+  {
+    return mix(mix(mix(table_seed) + stream) + unsigned(thread));
+  }
+
+  // start of the n-th block of a sequence
+  inline int block_start(uint64_t key, uint64_t n)
+  {
+    return mix(key + n*0x9e3779b97f4a7c15ull) % (table_size - block_length + 1);
+  }
+
+  // position of a thread in one of the tables: the numbers are read by
+  // blocks starting at random positions (given by the sequence and the index
+  // of the block) such that the sequences are not shifted copies of each
+  // other
+  struct position
+  {
+    // number of values read and start of the current block
+    uint64_t count;
+    int start;
+
+    // index of the next value
+    int next(uint64_t key)
+    {
+      const int offset = count % block_length;
+      if(offset==0) start = block_start(key, count/block_length);
+      ++count;
+      return start + offset;
+    }
+  };
+
+  // position of a thread in the tables
+  struct cursor
+  {
+    position normal, unifor;
+    // the sequence
+    uint64_t key;
+    // cursors from an older epoch are reset on first use
+    unsigned epoch;
+  };
+
+  // position after count values of a sequence
+  inline position resume(uint64_t key, uint64_t count)
+  {
+    return { count, block_start(key, count/block_length) };
+  }
+
+  // current epoch (incremented when the tables are populated)
+  atomic<unsigned> epoch(1);
+  // the cursor of the calling thread
+  thread_local cursor local = { { 0, 0 }, { 0, 0 }, 0, 0 };
+
+  // index of the calling thread
+  inline int thread_index()
+  {
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+  }
+
+  // cursor of the calling thread
+  inline cursor& get_cursor()
+  {
+    const unsigned e = epoch.load(memory_order_relaxed);
+    if(local.epoch!=e)
+    {
+      // each thread starts its own sequence on stream 0
+      const uint64_t key = stream_key(0, thread_index());
+      local = { resume(key, 0), resume(key, 0), key, e };
+    }
+    return local;
+  }
+} // namespace
 
 // return random real, uniform distribution
 float random_real()
 {
   //return r4_uni_value();
 
-  static int i = -1;
-  if(++i==table_size) i=0;
-  return unifor_values[i];
+  auto& c = get_cursor();
+  return unifor_values[c.unifor.next(c.key)];
 }
 
 // return random real, normally distributed
@@ -27,23 +127,71 @@ float random_normal()
 {
   //return r4_nor_value();
 
-  static int i = -1;
-  if(++i==table_size) i=0;
-  return normal_values[i];
+  auto& c = get_cursor();
+  return normal_values[c.normal.next(c.key)];
 }
 
-void init_random()
+void init_random(unsigned seed)
 {
   // init
-  random_device rd;
-  zigset(rd(), rd(), rd(), rd());
+  if(seed==0) seed = random_device()();
+  table_seed = seed;
+
+  // setup the ziggurat tables
+  zigset(1, 2, 3, 4);
 
-  // populate tables
-  for(size_t i=0; i<table_size; ++i)
+  // populate the tables by blocks, each with its own generator seeded from
+  // the block index such that the tables do not depend on the number of
+  // threads (and the pages are first touched by the thread using them)
+  constexpr int nblocks = 256;
+  constexpr int block_size = table_size/nblocks;
+#pragma omp parallel for schedule(static)
+  for(int b=0; b<nblocks; ++b)
   {
-    normal_values[i] = r4_nor_value();
-    unifor_values[i] = r4_uni_value();
+    seed_seq seq { seed, unsigned(b) };
+    uint32_t s[4];
+    seq.generate(s, s+4);
+    zigseed(s[0], s[1], s[2], s[3]);
+
+    r4_fill(&normal_values[b*block_size], &unifor_values[b*block_size], block_size);
   }
+
+  // rewind
+  ++epoch;
+  ready = true;
+}
+
+bool random_ready()
+{
+  return ready;
+}
+
+size_t random_memory()
+{
+  return 2*table_size*sizeof(float);
+}
+
+random_streams::random_streams(unsigned stream)
+  : stream(stream)
+{}
+
+void random_streams::resize(int n)
+{
+  normal.resize(max<size_t>(normal.size(), n), 0);
+  unifor.resize(max<size_t>(unifor.size(), n), 0);
+}
+
+void random_streams::load(int i) const
+{
+  const uint64_t key = stream_key(stream, i);
+  local = { resume(key, normal[i]), resume(key, unifor[i]), key, epoch.load() };
+}
+
+void random_streams::store(int i)
+{
+  get_cursor();
+  normal[i] = local.normal.count;
+  unifor[i] = local.unifor.count;
 }
 
 uint32_t random_uint32()
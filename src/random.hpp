@@ -1,8 +1,50 @@
 #ifndef RANDOM_HPP_
 #define RANDOM_HPP_
 
-// self explanatory
-void init_random();
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+/** Populate the tables using a given seed (0 is random)
+ *
+ * The tables are shared between all threads and each thread reads them from
+ * its own position, such that the functions below are thread safe.
+ * */
+void init_random(unsigned seed = 0);
+
+// have the tables been populated? (see init_random)
+bool random_ready();
+
+// memory used by the random tables in bytes
+std::size_t random_memory();
+
+/** Independent random streams, one for each thread
+ *
+ * Allows several systems to draw from their own streams on the same threads:
+ * each thread loads its position from the object before drawing numbers and
+ * stores it back afterwards. Every thread of every stream reads the tables
+ * by blocks of consecutive numbers, each block starting at a position hashed
+ * from the seed, the stream, the thread and the index of the block: two
+ * sequences only share the numbers of the few blocks that happen to overlap,
+ * instead of being shifted copies of each other.
+ * */
+class random_streams
+{
+  // index of the stream
+  unsigned stream;
+  // numbers drawn by each thread from each table
+  std::vector<std::uint64_t> normal, unifor;
+
+public:
+  random_streams(unsigned stream = 0);
+
+  // make sure that n threads have a position
+  void resize(int n);
+  // load/store the position of the calling thread (must be the i-th thread)
+  void load(int i) const;
+  void store(int i);
+};
+
 // return random real, uniform distribution
 float random_real();
 // return random real, normally distributed
@@ -20,6 +62,28 @@ inline float random_normal(float mu, float sigma)
   return mu + sigma*random_normal();
 }
 
+/** Random real with gamma distribution of given shape (and unit scale)
+ *
+ * Marsaglia-Tsang method, uses about one normal and one uniform number.
+ * */
+inline float random_gamma(float shape)
+{
+  // boost the shape above one
+  if(shape<1)
+    return random_gamma(shape+1)*std::pow(random_real(), 1/shape);
+
+  const float d = shape - 1.f/3, c = 1/std::sqrt(9*d);
+  while(true)
+  {
+    const float x = random_normal();
+    float v = 1 + c*x;
+    if(v<=0) continue;
+    v = v*v*v;
+    const float u = random_real();
+    if(std::log(u) < x*x/2 + d - d*v + d*std::log(v)) return d*v;
+  }
+}
+
 // generate unisgned in range [lower, upper)
 inline uint32_t random_uint32(uint32_t lower, uint32_t upper)
 {
@@ -0,0 +1,161 @@
+//
+// a complete system
+//
+
+#include "perf.hpp"
+#include "simulation.hpp"
+#include "trace.hpp"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+  // check the parameters (and the random tables) before constructing anything
+  // from them
+  parameters prepared(parameters params)
+  {
+    if(not random_ready())
+      throw inline_str("init_random must be called before creating a "
+                       "simulation");
+    params.prepare();
+    return params;
+  }
+} // namespace
+
+simulation::simulation(const parameters& params, unsigned stream)
+  : params(prepared(params)), boxes(params), kernel(get_engine(params.engine)),
+    rng(stream)
+{
+  load_random();
+  particles = create_particles(params);
+  store_random();
+}
+
+void simulation::load_random()
+{
+#ifdef _OPENMP
+  rng.resize(omp_get_max_threads());
+#pragma omp parallel
+  rng.load(omp_get_thread_num());
+#else
+  rng.resize(1);
+  rng.load(0);
+#endif
+}
+
+void simulation::store_random()
+{
+#ifdef _OPENMP
+#pragma omp parallel
+  rng.store(omp_get_thread_num());
+#else
+  rng.store(0);
+#endif
+}
+
+void simulation::step(int n)
+{
+  load_random();
+
+  for(int k=0; k<n; ++k, ++time)
+  {
+    // the random shift
+    boxes.set_shift(vec {{ random_real(), random_real() }});
+
+    // the whole step tile by tile if possible, phase by phase otherwise or
+    // when the phases are timed separately
+    if(not perf_enabled() and boxes.can_fuse(particles, params))
+    {
+      phase_scope s(phase_fused);
+      boxes.step(particles, kernel, params);
+    }
+    else
+      step_phases();
+
+    // record occupancy of the boxes
+    if(trace_active())
+    {
+      // bins are a quarter of the mean occupancy wide
+      const unsigned width = max(1, accumulate(begin(params.dens), end(params.dens), 0)/4);
+      vector<unsigned> histogram(16, 0u);
+      const auto& state = boxes.get_boxes();
+      for(size_t k=0; k<state.size(); ++k)
+        ++histogram[min(state.occupancy(k)/width, histogram.size()-1)];
+      trace_occupancy(histogram, width);
+    }
+  }
+
+  store_random();
+}
+
+void simulation::step_phases()
+{
+  // stream particles
+  {
+    phase_scope s(phase_stream);
+#pragma omp parallel
+    {
+      trace_scope t(phase_stream);
+      // contiguous ranges as with a static schedule, such that each thread
+      // streams the particles it first touched (see create_particles)
+#ifdef _OPENMP
+      const size_t nthreads = omp_get_num_threads(), me = omp_get_thread_num();
+#else
+      const size_t nthreads = 1, me = 0;
+#endif
+      const size_t q = particles.size()/nthreads, r = particles.size()%nthreads;
+      const size_t first = me*q + min(me, r);
+      stream_particles(&particles[0] + first,
+                       &particles[0] + first + q + (me<r), params);
+    }
+  }
+
+  // bucket particles
+  {
+    phase_scope s(phase_bucket);
+    boxes.update(particles);
+  }
+
+  // collision
+  {
+    phase_scope s(phase_collision);
+    boxes.collision(kernel, params);
+  }
+}
+
+void simulation::analyse()
+{
+  phase_scope s(phase_analysis);
+  boxes.set_shift({{0,0}});
+  boxes.update(particles);
+}
+
+void simulation::set_kappa(const vector<float>& kappa)
+{
+  if(kappa.size()!=size_t(params.ntypes))
+    throw inline_str("wrong number of interaction parameters");
+  // replaces the interaction matrix, if any
+  params.kappa = kappa;
+  params.M.clear();
+  params.prepare();
+}
+
+size_t memory_estimate(const parameters& params)
+{
+  // the fields of the box (counts, velocity, energy, first particle and
+  // number of particles) and the quadrants of the owner cell
+  const size_t per_box = params.ntypes*sizeof(int) + sizeof(vec) + sizeof(float)
+    + sizeof(particle**) + sizeof(unsigned) + sizeof(array<unsigned, 4>);
+
+  // the particles and the particle lists of the boxes and of the owner cells
+  return params.ntot()*(sizeof(particle) + 2*sizeof(particle*))
+    + params.nboxes()*per_box;
+}
+
+void simulation::set_stream(unsigned stream)
+{
+  rng = random_streams(stream);
+}
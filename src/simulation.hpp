@@ -0,0 +1,83 @@
+// simulation.hpp
+// a complete system: parameters, particles, grid and random streams
+
+#ifndef SIMULATION_HPP_
+#define SIMULATION_HPP_
+
+#include "model.hpp"
+
+/** A single system that can be stepped forward
+ *
+ * Owns all its state such that several systems can live in the same process
+ * (only the read-only random tables are shared, see init_random() which must
+ * be called first). The particles and the boxes are exposed by reference
+ * such that analyses can be done in-process without any copy.
+ * */
+class simulation
+{
+  // the parameters
+  parameters params;
+  // all particles
+  particle_store particles;
+  // the boxes
+  grid boxes;
+  // the collision kernel
+  collision_kernel kernel;
+  // random streams of each thread
+  random_streams rng;
+  // number of steps done
+  int time = 0;
+
+  // load/store the random streams on every thread
+  void load_random();
+  void store_random();
+  // stream, bucket and collide as separate passes over all particles
+  void step_phases();
+
+public:
+  // create the particles at random using the given random stream
+  simulation(const parameters& params, unsigned stream = 0);
+
+  // do n time steps
+  void step(int n = 1);
+
+  // rebucket the particles with zero shift such that the boxes describe the
+  // current state (mean velocities and energies are from the last collision)
+  void analyse();
+
+  // change the interaction parameters (e.g. after a quench), this replaces
+  // the interaction matrix if one was given
+  void set_kappa(const std::vector<float>& kappa);
+  // switch to another random stream
+  void set_stream(unsigned stream);
+
+  // parameters of the system
+  const parameters& get_parameters() const
+  { return params; }
+  // number of time steps done
+  int get_time() const
+  { return time; }
+  // the particles (may be modified, e.g. to set initial conditions, in which
+  // case the reference must be obtained again after each step)
+  const particle_store& get_particles() const
+  { return particles; }
+  particle_store& get_particles()
+  {
+    boxes.forget_vmax();
+    return particles;
+  }
+  // the boxes (may be modified, e.g. to tune the bucketing)
+  const grid& get_grid() const
+  { return boxes; }
+  grid& get_grid()
+  { return boxes; }
+};
+
+/** Estimate of the memory used by a simulation in bytes
+ *
+ * Includes the particles and the boxes with their lists of particles, but not
+ * the random tables that are shared by all simulations (see random_memory).
+ * */
+std::size_t memory_estimate(const parameters& params);
+
+#endif//SIMULATION_HPP_
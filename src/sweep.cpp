@@ -0,0 +1,331 @@
+//
+// parameter sweeps over a base runcard
+//
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "sweep.hpp"
+#include "tools.hpp"
+
+using namespace std;
+
+namespace
+{
+  // a single run of the sweep
+  struct job
+  {
+    int index;
+    // job directory
+    string directory;
+    // values of the swept parameters
+    vector<pair<string, string>> values;
+    // number of threads
+    int threads;
+
+    // exit status
+    int status = 0;
+    // completed by a previous sweep?
+    bool skipped = false;
+    // wall clock time
+    double seconds = 0;
+  };
+
+  // jobs owned by a single worker (others steal from the back)
+  struct job_queue
+  {
+    mutex m;
+    deque<job*> jobs;
+  };
+
+  // number of cores available to the jobs
+  class budget
+  {
+    mutex m;
+    condition_variable cv;
+    int available;
+
+  public:
+    budget(int n)
+      : available(n)
+    {}
+
+    void acquire(int n)
+    {
+      unique_lock<mutex> lock(m);
+      cv.wait(lock, [&]{ return available>=n; });
+      available -= n;
+    }
+
+    void release(int n)
+    {
+      {
+        lock_guard<mutex> lock(m);
+        available += n;
+      }
+      cv.notify_all();
+    }
+  };
+
+  // remove leading and trailing spaces
+  string trim(const string& s)
+  {
+    const auto b = s.find_first_not_of(" \t");
+    if(b==s.npos) return "";
+    return s.substr(b, s.find_last_not_of(" \t\r")-b+1);
+  }
+
+  // expand 'start:stop:step' or 'v1; v2; ...' to the list of values
+  vector<string> expand(const string& spec)
+  {
+    vector<string> values;
+
+    if(spec.find(':')!=spec.npos and spec.find('[')==spec.npos)
+    {
+      const auto r = get_floats_from_string(
+        [](string s) { replace(begin(s), end(s), ':', ','); return s; }(spec));
+      if(r.size()!=3 or r[2]<=0)
+        throw inline_str("wrong format for range ", spec);
+      // inclusive with some tolerance on the last value
+      for(int i=0; r[0]+i*r[2]<=r[1]+r[2]/1e3; ++i)
+        values.push_back(inline_str(r[0]+i*r[2]));
+    }
+    else
+      for(size_t p=0, q=0; p!=spec.npos; p=q)
+      {
+        q = spec.find(';', p+(p!=0));
+        const auto v = trim(spec.substr(p+(p!=0), q-p-(p!=0)));
+        if(not v.empty()) values.push_back(v);
+      }
+
+    if(values.empty()) throw inline_str("no values in sweep entry ", spec);
+    return values;
+  }
+
+  // read the sweep specification
+  vector<pair<string, vector<string>>> read_spec(const string& fname)
+  {
+    ifstream file(fname);
+    if(not file.good())
+      throw inline_str("error while opening sweep file ", fname);
+
+    vector<pair<string, vector<string>>> spec;
+    for(string line; getline(file, line);)
+    {
+      line = trim(line.substr(0, line.find('#')));
+      if(line.empty()) continue;
+
+      const auto eq = line.find('=');
+      if(eq==line.npos) throw inline_str("wrong line in sweep file: ", line);
+      spec.push_back({ trim(line.substr(0, eq)), expand(line.substr(eq+1)) });
+    }
+
+    return spec;
+  }
+
+  // read all lines of a file
+  vector<string> read_lines(const string& fname)
+  {
+    ifstream file(fname);
+    if(not file.good())
+      throw inline_str("error while opening runcard file ", fname);
+
+    vector<string> lines;
+    for(string line; getline(file, line);) lines.push_back(line);
+    return lines;
+  }
+
+  // write the runcard of a job: base runcard with the swept values substituted
+  void write_runcard(const job& j, const vector<string>& base)
+  {
+    ofstream file(inline_str(j.directory, "/parameters"));
+    if(not file.good())
+      throw inline_str("unable to write runcard in ", j.directory);
+
+    for(const auto& line : base)
+    {
+      const auto key = trim(line.substr(0, line.find('=')));
+      if(none_of(begin(j.values), end(j.values),
+                 [&](const pair<string, string>& v) { return v.first==key; }))
+        file << line << endl;
+    }
+
+    file << endl << "# sweep" << endl;
+    for(const auto& v : j.values)
+      if(v.first!="threads") file << v.first << " = " << v.second << endl;
+  }
+
+  // has the job been completed by a previous sweep?
+  bool completed(const job& j)
+  {
+    return ifstream(inline_str(j.directory, "/summary")).good();
+  }
+
+  // run the executable on the job directory, return the exit status
+  int run(const job& j, const string& executable)
+  {
+    // no allocation is allowed between fork and exec
+    const string logname = inline_str(j.directory, "/log");
+    const string threads = inline_str(j.threads);
+
+    const pid_t pid = fork();
+    if(pid<0) return -1;
+
+    if(pid==0)
+    {
+      // redirect output to the job directory
+      const int fd = open(logname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if(fd>=0)
+      {
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+      }
+
+      execl(executable.c_str(), executable.c_str(), j.directory.c_str(),
+            "--threads", threads.c_str(), (char*)nullptr);
+      _exit(127);
+    }
+
+    int status;
+    if(waitpid(pid, &status, 0)<0) return -1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+  }
+} // namespace
+
+int sweep(const string& directory,
+          const string& specname,
+          const string& executable,
+          int cores)
+{
+  const auto spec = read_spec(inline_str(directory, "/", specname));
+  const auto base = read_lines(inline_str(directory, "/parameters"));
+
+  // expand the cartesian product of all values
+  vector<job> jobs(1);
+  for(const auto& s : spec)
+  {
+    vector<job> expanded;
+    for(const auto& j : jobs)
+      for(const auto& v : s.second)
+      {
+        expanded.push_back(j);
+        expanded.back().values.push_back({ s.first, v });
+      }
+    jobs.swap(expanded);
+  }
+
+  for(size_t i=0; i<jobs.size(); ++i)
+  {
+    auto& j = jobs[i];
+    j.index = i;
+    j.directory = inline_str(directory, "/job", i);
+    j.threads = 1;
+    for(const auto& v : j.values)
+      if(v.first=="threads") j.threads = max(1, atoi(v.second.c_str()));
+    j.threads = min(j.threads, cores);
+  }
+
+  cout << "sweep: " << jobs.size() << " jobs on " << cores << " cores" << endl;
+
+  // distribute the jobs round robin over the workers
+  const int nworkers = cores;
+  vector<job_queue> queues(nworkers);
+  for(auto& j : jobs) queues[j.index % nworkers].jobs.push_back(&j);
+
+  budget cores_left(cores);
+  mutex print;
+
+  const auto worker = [&](int w) {
+    while(true)
+    {
+      job* j = nullptr;
+
+      // own jobs first, from the front...
+      {
+        lock_guard<mutex> lock(queues[w].m);
+        if(not queues[w].jobs.empty())
+        {
+          j = queues[w].jobs.front();
+          queues[w].jobs.pop_front();
+        }
+      }
+      // ... then steal from the back of the others
+      for(int k=1; not j and k<nworkers; ++k)
+      {
+        auto& q = queues[(w+k) % nworkers];
+        lock_guard<mutex> lock(q.m);
+        if(not q.jobs.empty())
+        {
+          j = q.jobs.back();
+          q.jobs.pop_back();
+        }
+      }
+      if(not j) return;
+
+      try
+      {
+        make_directory(j->directory);
+        if(completed(*j))
+        {
+          j->skipped = true;
+          continue;
+        }
+        write_runcard(*j, base);
+      }
+      catch(const string& s)
+      {
+        lock_guard<mutex> lock(print);
+        cerr << "job " << j->index << ": " << s << endl;
+        j->status = -1;
+        continue;
+      }
+
+      cores_left.acquire(j->threads);
+      const auto start = chrono::steady_clock::now();
+      j->status = run(*j, executable);
+      j->seconds = chrono::duration<double>(chrono::steady_clock::now()
+                                            - start).count();
+      cores_left.release(j->threads);
+
+      lock_guard<mutex> lock(print);
+      cout << "job " << j->index << (j->status ? " FAILED" : " done")
+           << " (" << j->seconds << " s)" << endl;
+    }
+  };
+
+  vector<thread> workers;
+  for(int w=0; w<nworkers; ++w) workers.emplace_back(worker, w);
+  for(auto& w : workers) w.join();
+
+  // write the index
+  ofstream index(inline_str(directory, "/sweep.csv"));
+  index << "job,directory,status,time";
+  for(const auto& s : spec) index << "," << s.first;
+  index << endl;
+
+  int failed = 0;
+  for(const auto& j : jobs)
+  {
+    failed += j.status!=0;
+    index << j.index << ",job" << j.index << ","
+          << (j.skipped ? "skipped" : j.status ? "failed" : "done") << ","
+          << j.seconds;
+    // values may contain commas
+    for(const auto& v : j.values) index << ",\"" << v.second << "\"";
+    index << endl;
+  }
+
+  cout << "sweep: " << jobs.size()-failed << " jobs completed, "
+       << failed << " failed" << endl;
+
+  return failed;
+}
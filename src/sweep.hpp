@@ -0,0 +1,34 @@
+// sweep.hpp
+// parameter sweeps over a base runcard
+
+#ifndef SWEEP_HPP_
+#define SWEEP_HPP_
+
+#include <string>
+
+/** Run a parameter sweep
+ *
+ * The sweep specification lists the parameters to vary, one per line, either
+ * as a list of values separated by semicolons or as an inclusive range:
+ *
+ *   kappa   = [1.6, 1.6]; [1.8, 1.8]
+ *   tau     = 1e-2:5e-2:1e-2
+ *   threads = 2
+ *
+ * where 'threads' is the number of threads used by each job. The cartesian
+ * product of all values is expanded into jobs: each job gets its own
+ * directory job<N>/ containing the base runcard with the swept values
+ * substituted. Jobs are run as separate processes of the executable by a
+ * work-stealing pool that never uses more than the given number of cores.
+ * Jobs that already completed (i.e. that wrote a summary) are skipped such
+ * that an interrupted sweep can be resumed. An index of all jobs is written
+ * to sweep.csv.
+ *
+ * Returns the number of failed jobs.
+ * */
+int sweep(const std::string& directory,
+          const std::string& specname,
+          const std::string& executable,
+          int cores);
+
+#endif//SWEEP_HPP_
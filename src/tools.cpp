@@ -6,6 +6,10 @@
 #include <iomanip>
 #include "header.hpp"
 #include "tools.hpp"
+#include <cerrno>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 // shortcut to boost program_options
 namespace opt = boost::program_options;
@@ -73,3 +77,54 @@ void print_vm(const opt::variables_map& vm, unsigned padding)
     }
   }
 }
+
+std::size_t peak_memory()
+{
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  // in kilobytes on linux
+  return std::size_t(usage.ru_maxrss)*1024;
+}
+
+void make_directory(const std::string& path)
+{
+  if(mkdir(path.c_str(), 0755)!=0 and errno!=EEXIST)
+    throw inline_str("unable to create directory ", path);
+}
+
+std::size_t available_memory()
+{
+  // available memory of the node
+  std::size_t available = 0;
+  {
+    std::ifstream meminfo("/proc/meminfo");
+    for(std::string key; meminfo >> key;)
+    {
+      std::size_t value;
+      meminfo >> value;
+      meminfo.ignore(256, '\n');
+      if(key=="MemAvailable:") available = value*1024;
+    }
+  }
+  if(available==0)
+    available = std::size_t(sysconf(_SC_AVPHYS_PAGES))*sysconf(_SC_PAGESIZE);
+
+  // limit of the control group (v2, then v1)
+  std::size_t limit, usage;
+  if((std::ifstream("/sys/fs/cgroup/memory.max") >> limit)
+     and (std::ifstream("/sys/fs/cgroup/memory.current") >> usage))
+    available = std::min(available, limit>usage ? limit-usage : 0);
+  else if((std::ifstream("/sys/fs/cgroup/memory/memory.limit_in_bytes") >> limit)
+          and (std::ifstream("/sys/fs/cgroup/memory/memory.usage_in_bytes") >> usage))
+    available = std::min(available, limit>usage ? limit-usage : 0);
+
+  return available;
+}
+
+std::string executable_path(const char* argv0)
+{
+  char path[4096];
+  const auto n = readlink("/proc/self/exe", path, sizeof(path)-1);
+  if(n<=0) return argv0;
+  return std::string(path, n);
+}
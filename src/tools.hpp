@@ -15,6 +15,48 @@
   */
 void print_vm(const boost::program_options::variables_map& vm, unsigned padding);
 
+// peak resident memory of the process in bytes
+std::size_t peak_memory();
+
+// memory that can still be allocated by the process in bytes (node and
+// control group limits)
+std::size_t available_memory();
+
+// create a directory if it does not exist (throws on failure)
+void make_directory(const std::string& path);
+
+// absolute path of the running executable (argv0 if unknown)
+std::string executable_path(const char* argv0);
+
+/** Allocator that default-initializes the elements
+ *
+ * Resizing a vector using it leaves trivial elements uninitialized, such that
+ * the memory is not touched before the threads that use it write to it (and
+ * the pages are placed on their NUMA node).
+ * */
+template<class T, class A = std::allocator<T>>
+class default_init_allocator : public A
+{
+  typedef std::allocator_traits<A> traits;
+
+public:
+  template<class U>
+  struct rebind
+  {
+    using other = default_init_allocator<
+      U, typename traits::template rebind_alloc<U>>;
+  };
+
+  using A::A;
+
+  template<class U>
+  void construct(U* p)
+  { ::new(static_cast<void*>(p)) U; }
+  template<class U, class... Args>
+  void construct(U* p, Args&&... args)
+  { traits::construct(static_cast<A&>(*this), p, std::forward<Args>(args)...); }
+};
+
 namespace detail
 {
   /** Convert to strig and catenate arguments */
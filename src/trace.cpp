@@ -0,0 +1,234 @@
+//
+// per-thread timeline of the step phases
+//
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include "trace.hpp"
+#include "tools.hpp"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+  // number of events per thread (must be a power of two)
+  constexpr size_t buffer_size = 1<<16;
+
+  // single begin/end pair
+  struct event
+  {
+    phase p;
+    int step;
+    // in microseconds since the start of the trace
+    double begin, end;
+  };
+
+  // ring buffer of events owned by a single thread
+  struct buffer
+  {
+    // thread index
+    int tid;
+    // the events
+    vector<event> events;
+    // total number of events written
+    atomic<size_t> head;
+    // next buffer in the list
+    buffer* next;
+    // begin times of the (nested) phases currently open
+    double open[8];
+    int depth;
+
+    buffer(int tid, buffer* next)
+      : tid(tid), events(buffer_size), head(0), next(next), depth(0)
+    {}
+  };
+
+  // occupancy histogram of a single step
+  struct occupancy
+  {
+    int step;
+    double time;
+    unsigned width;
+    vector<unsigned> histogram;
+  };
+
+  // is tracing enabled?
+  bool enabled = false;
+  // window of time steps
+  int first_step, last_step;
+  // current step, is it within the window?
+  atomic<int> current_step(0);
+  atomic<bool> active(false);
+  // start of the trace
+  chrono::steady_clock::time_point start;
+  // list of all buffers (lock-free insertion)
+  atomic<buffer*> buffers(nullptr);
+  // number of threads registered
+  atomic<int> nthreads(0);
+  // the buffer of the calling thread
+  thread_local buffer* local = nullptr;
+  // nesting level and index of the thread stepping the traced system (the
+  // other replicas being stepped by other threads)
+  atomic<int> owner_level(0), owner_thread(0);
+  // occupancy histograms (recorded by the stepping thread only)
+  vector<occupancy> occupancies;
+
+  // does the calling thread step the traced system?
+  bool stepping()
+  {
+#ifdef _OPENMP
+    return omp_get_level()==owner_level
+      and omp_get_thread_num()==owner_thread;
+#else
+    return true;
+#endif
+  }
+
+  // does the calling thread work for the traced system? (i.e. is it the
+  // stepping thread or one of the threads it forked)
+  bool working()
+  {
+#ifdef _OPENMP
+    const int level = owner_level;
+    return omp_get_level()>=level
+      and omp_get_ancestor_thread_num(level)==owner_thread;
+#else
+    return true;
+#endif
+  }
+
+  // time since the start of the trace in microseconds
+  double now()
+  {
+    return chrono::duration<double, micro>(chrono::steady_clock::now()
+                                           - start).count();
+  }
+
+  // return the buffer of the calling thread, create it if needed
+  buffer* get_buffer()
+  {
+    if(local) return local;
+
+    local = new buffer(nthreads++, buffers.load());
+    while(not buffers.compare_exchange_weak(local->next, local));
+    return local;
+  }
+} // namespace
+
+void trace_init(int first, int last)
+{
+  enabled = true;
+  first_step = first;
+  last_step = last;
+  start = chrono::steady_clock::now();
+}
+
+void trace_step(int step)
+{
+  if(not enabled) return;
+
+#ifdef _OPENMP
+  owner_level = omp_get_level();
+  owner_thread = omp_get_thread_num();
+#endif
+  current_step = step;
+  active = first_step<=step and step<=last_step;
+}
+
+void trace_done()
+{
+  active = false;
+}
+
+bool trace_active()
+{
+  return active and stepping();
+}
+
+void trace_begin(phase p)
+{
+  if(not active or not working()) return;
+
+  auto b = get_buffer();
+  b->open[b->depth++ & 7] = now();
+}
+
+void trace_end(phase p)
+{
+  if(not active or not working()) return;
+
+  auto b = get_buffer();
+  const size_t h = b->head.load(memory_order_relaxed);
+  const double begin = b->open[--b->depth & 7];
+  b->events[h & (buffer_size-1)] = { p, current_step, begin, now() };
+  b->head.store(h+1, memory_order_release);
+}
+
+void trace_occupancy(const vector<unsigned>& histogram, unsigned width)
+{
+  if(not active or not stepping()) return;
+
+  occupancies.push_back({ current_step, now(), width, histogram });
+}
+
+void trace_dump(const string& fname)
+{
+  if(not enabled) return;
+
+  ofstream file(fname, ios::out);
+  if(not file.good())
+    throw inline_str("unable to open file ", fname, " for writing");
+
+  file << "{\"traceEvents\":[" << endl;
+
+  bool first = true;
+  const auto sep = [&]() -> const char* {
+    if(first) { first = false; return ""; }
+    return ",\n";
+  };
+
+  // thread names
+  for(auto b = buffers.load(); b; b = b->next)
+    file << sep()
+         << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << b->tid
+         << ",\"args\":{\"name\":\"thread " << b->tid << "\"}}";
+
+  // phases
+  for(auto b = buffers.load(); b; b = b->next)
+  {
+    const size_t h = b->head.load(memory_order_acquire);
+    const size_t n = min(h, buffer_size);
+    for(size_t i=h-n; i<h; ++i)
+    {
+      const auto& e = b->events[i & (buffer_size-1)];
+      file << sep()
+           << "{\"name\":\"" << phase_names[e.p] << "\",\"ph\":\"X\",\"pid\":0"
+           << ",\"tid\":" << b->tid
+           << ",\"ts\":" << fixed << e.begin
+           << ",\"dur\":" << e.end - e.begin
+           << ",\"args\":{\"step\":" << e.step << "}}";
+    }
+  }
+
+  // occupancy histograms as counters
+  for(const auto& o : occupancies)
+  {
+    file << sep()
+         << "{\"name\":\"occupancy\",\"ph\":\"C\",\"pid\":0,\"ts\":" << o.time
+         << ",\"args\":{";
+    for(size_t i=0; i<o.histogram.size(); ++i)
+    {
+      file << (i ? "," : "") << "\"" << i*o.width;
+      if(i+1==o.histogram.size()) file << "+\"";
+      else file << "-" << (i+1)*o.width-1 << "\"";
+      file << ":" << o.histogram[i];
+    }
+    file << "}}";
+  }
+
+  file << endl << "]}" << endl;
+}
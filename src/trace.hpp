@@ -0,0 +1,63 @@
+// trace.hpp
+// per-thread timeline of the step phases in Chrome trace-event format
+
+#ifndef TRACE_HPP_
+#define TRACE_HPP_
+
+#include <string>
+#include <vector>
+#include "phase.hpp"
+
+/** Enable tracing between two time steps (inclusive)
+ *
+ * Each thread records the begin/end of every phase in its own fixed-size ring
+ * buffer: recording never takes a lock and, if the buffer overflows, the
+ * oldest events are overwritten.
+ * */
+void trace_init(int first, int last);
+
+/** Set the current time step, to be called by the thread stepping the
+ * traced system
+ *
+ * Only the steps within the window are recorded, and only by this thread and
+ * by the threads of the parallel regions it forks: the threads stepping
+ * other replicas are ignored.
+ * */
+void trace_step(int step);
+
+// the traced system is done, stop recording
+void trace_done();
+
+// begin/end of a phase on the calling thread (can be nested)
+void trace_begin(phase p);
+void trace_end(phase p);
+
+// trace the work of a single thread within a phase
+struct trace_scope
+{
+  const phase p;
+
+  trace_scope(phase p)
+    : p(p)
+  { trace_begin(p); }
+  ~trace_scope()
+  { trace_end(p); }
+};
+
+/** Record the histogram of box occupancies for the current step
+ *
+ * Bin i counts the boxes holding [i*width, (i+1)*width) particles, the last
+ * bin being open ended. Only the thread that sets the time steps (see
+ * trace_step) records them, calls from the threads stepping other replicas
+ * are ignored.
+ * */
+void trace_occupancy(const std::vector<unsigned>& histogram, unsigned width);
+
+// is the current step being traced by the calling thread? (i.e. is it
+// within the window and does the thread set the time steps)
+bool trace_active();
+
+// write all events as Chrome/Perfetto JSON
+void trace_dump(const std::string& fname);
+
+#endif//TRACE_HPP_
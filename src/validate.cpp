@@ -0,0 +1,463 @@
+//
+// statistical equivalence of the collision engines
+//
+
+#include <cstring>
+#include <limits>
+#include <map>
+#include "simulation.hpp"
+#include "validate.hpp"
+
+using namespace std;
+
+namespace
+{
+  // significance level of the KS tests
+  constexpr double ks_threshold = 1e-3;
+  // maximal momentum drift per particle
+  constexpr double momentum_threshold = 1e-5;
+  // number of independent runs (random streams) of each engine from which
+  // the transport coefficients and their error bars are estimated
+  constexpr int transport_samples = 4;
+  // largest deviation of the transport coefficients of an engine from the
+  // reference, in units of the statistical error of the difference
+  constexpr double transport_sigmas = 5;
+  // amplitude of the shear wave
+  constexpr float shear_amplitude = .5f;
+  // maximal fraction of the noise of a stream shared with another one
+  constexpr double shared_threshold = .1;
+  // largest velocity component expected among ~1e5 particles at unit
+  // temperature
+  constexpr float typical_vmax = 4.5f;
+  // number of steps of the tiled runs (many particles cross a tile at each
+  // step)
+  constexpr int tiling_steps = 50;
+
+  // observables measured for a single engine
+  struct measurement
+  {
+    // number of particles of each type (before and after)
+    vector<int64_t> counts_before, counts_after;
+    // maximal drift of the total momentum per particle
+    double momentum_drift = 0;
+    // all velocity components at the end of the run
+    vector<double> velocities;
+    // self-diffusion constant and kinematic viscosity of each run
+    vector<double> diffusion, viscosity;
+  };
+
+  // observables of a run tiled when possible (or rebuilding the boxes)
+  struct tiling
+  {
+    // largest deviation of the number of particles of a type at any step
+    int64_t count_drift = 0;
+    // all velocity components at the end of the run
+    vector<double> velocities;
+  };
+
+  // number of particles of each type in the grid
+  vector<int64_t> count_types(const grid& boxes, int ntypes)
+  {
+    vector<int64_t> counts(ntypes, 0);
+    const auto& n = boxes.get_boxes().n;
+    for(size_t k=0; k<n.size(); ++k)
+      counts[k%ntypes] += n[k];
+    return counts;
+  }
+
+  // total momentum
+  vector<double> total_momentum(const particle_store& particles)
+  {
+    vector<double> P(dim, 0.);
+    for(const auto& p : particles)
+      for(int i=0; i<dim; ++i)
+        P[i] += p.v[i];
+    return P;
+  }
+
+  // slope of the least square fit y = a + b*x
+  double fit_slope(const vector<double>& x, const vector<double>& y)
+  {
+    const double n = x.size();
+    const double sx  = accumulate(begin(x), end(x), 0.);
+    const double sy  = accumulate(begin(y), end(y), 0.);
+    const double sxx = inner_product(begin(x), end(x), begin(x), 0.);
+    const double sxy = inner_product(begin(x), end(x), begin(y), 0.);
+    return (n*sxy - sx*sy)/(n*sxx - sx*sx);
+  }
+
+  // mean and variance of a sample
+  double mean(const vector<double>& x)
+  {
+    return accumulate(begin(x), end(x), 0.)/x.size();
+  }
+
+  double variance(const vector<double>& x)
+  {
+    const double m = mean(x);
+    double sq = 0;
+    for(double v : x) sq += (v-m)*(v-m);
+    return sq/(x.size()-1);
+  }
+
+  // tolerance shown next to the name of a check
+  string percent(double x)
+  {
+    return inline_str("+-", lround(100*x), "%");
+  }
+
+  // equilibrium run: conservation laws, velocities and diffusion (the
+  // velocities are only kept from the first stream)
+  void measure_equilibrium(parameters params, int steps, unsigned stream,
+                           measurement& m)
+  {
+    simulation sim(params, stream);
+    const auto& particles = sim.get_particles();
+
+    // thermalize
+    sim.step();
+    const auto counts = count_types(sim.get_grid(), params.ntypes);
+    if(stream==0) m.counts_before = counts;
+    for(int a=0; a<params.ntypes; ++a)
+      if(counts[a]!=params.npart(a)) m.counts_before[a] = counts[a];
+    const auto P0 = total_momentum(particles);
+
+    // unwrapped displacements
+    vector<vec> disp(particles.size(), vec(0.f));
+    vector<double> times, msd;
+
+    for(int t=1; t<=steps; ++t)
+    {
+      for(size_t i=0; i<particles.size(); ++i)
+        disp[i] += params.tau*particles[i].v;
+
+      sim.step();
+
+      // momentum drift
+      const auto P = total_momentum(particles);
+      for(int i=0; i<dim; ++i)
+        m.momentum_drift = max(m.momentum_drift,
+                               abs(P[i]-P0[i])/particles.size());
+
+      // mean square displacement over the second half of the run
+      if(2*t>=steps)
+      {
+        double sq = 0;
+        for(const auto& d : disp) sq += d.sq();
+        times.push_back(t*params.tau);
+        msd.push_back(sq/particles.size());
+      }
+    }
+
+    const auto after = count_types(sim.get_grid(), params.ntypes);
+    if(stream==0) m.counts_after = after;
+    for(int a=0; a<params.ntypes; ++a)
+      if(after[a]!=params.npart(a)) m.counts_after[a] = after[a];
+    m.diffusion.push_back(fit_slope(times, msd)/(2*dim));
+
+    if(stream>0) return;
+    for(const auto& p : particles)
+      for(int i=0; i<dim; ++i)
+        m.velocities.push_back(p.v[i]);
+    sort(begin(m.velocities), end(m.velocities));
+  }
+
+  // run with the time steps done tile by tile when possible (or migrating the
+  // particles otherwise) or rebuilding the boxes at each step
+  void measure_tiling(parameters params, int steps, bool rebuild, tiling& m)
+  {
+    simulation sim(params);
+    sim.get_grid().set_rebuild(rebuild);
+    const auto& particles = sim.get_particles();
+
+    for(int t=0; t<steps; ++t)
+    {
+      sim.step();
+      const auto counts = count_types(sim.get_grid(), params.ntypes);
+      for(int a=0; a<params.ntypes; ++a)
+        m.count_drift = max(m.count_drift, abs(counts[a]-params.npart(a)));
+    }
+
+    for(const auto& p : particles)
+      for(int i=0; i<dim; ++i)
+        m.velocities.push_back(p.v[i]);
+    sort(begin(m.velocities), end(m.velocities));
+  }
+
+  // decay of a transverse shear wave v_x = A sin(k y)
+  void measure_viscosity(parameters params, int steps, unsigned stream,
+                         measurement& m)
+  {
+    simulation sim(params, stream);
+    auto& particles = sim.get_particles();
+
+    const double k = 2*M_PI/params.L[1];
+    for(auto& p : particles)
+      p.v[0] = shear_amplitude*sin(k*p.x[1]);
+
+    // amplitude of the mode
+    const auto amplitude = [&]() {
+      double a = 0;
+      for(const auto& p : particles) a += p.v[0]*sin(k*p.x[1]);
+      return 2*a/particles.size();
+    };
+
+    vector<double> times, logs;
+    for(int t=1; t<=steps; ++t)
+    {
+      sim.step();
+
+      // stop once the wave is lost in the thermal noise
+      const double a = amplitude();
+      if(a<shear_amplitude/5) break;
+      times.push_back(t*params.tau);
+      logs.push_back(log(a));
+    }
+
+    m.viscosity.push_back(-fit_slope(times, logs)/k/k);
+  }
+
+  /* Largest fraction of the first draws shared by two random streams
+   *
+   * The sequences compared are the ones of the replicas and branches (stream
+   * s on thread 0), of the threads of stream 0 and of a few far streams. The
+   * draws are identified by pairs of consecutive numbers, such that a single
+   * value found twice in the tables does not count. Independent sequences
+   * share about ndraws/table size of their draws by chance.
+   * */
+  double shared_noise(size_t ndraws)
+  {
+    vector<pair<unsigned, int>> sequences;
+    for(unsigned s=0; s<=8; ++s) sequences.push_back({ s, 0 });
+    for(int t=1; t<8; ++t) sequences.push_back({ 0, t });
+    for(unsigned s : { 256u, 65536u }) sequences.push_back({ s, 0 });
+
+    // pairs of consecutive draws of each sequence
+    vector<pair<uint64_t, unsigned>> keys;
+    for(unsigned q=0; q<sequences.size(); ++q)
+    {
+      random_streams rng(sequences[q].first);
+      rng.resize(sequences[q].second+1);
+      rng.load(sequences[q].second);
+
+      uint32_t last, next;
+      float x = random_normal();
+      memcpy(&last, &x, sizeof(x));
+      for(size_t n=1; n<ndraws; ++n, last=next)
+      {
+        x = random_normal();
+        memcpy(&next, &x, sizeof(x));
+        keys.push_back({ uint64_t(last)<<32 | next, q });
+      }
+    }
+    sort(begin(keys), end(keys));
+
+    // count the pairs found in both sequences of each couple
+    const size_t nseq = sequences.size();
+    vector<size_t> shared(nseq*nseq, 0);
+    for(size_t i=0, j=0; i<keys.size(); i=j)
+    {
+      while(j<keys.size() and keys[j].first==keys[i].first) ++j;
+      for(size_t a=i; a<j; ++a)
+        for(size_t b=a+1; b<j; ++b)
+          if(keys[a].second!=keys[b].second)
+            ++shared[keys[a].second*nseq + keys[b].second];
+    }
+
+    return double(*max_element(begin(shared), end(shared)))/(ndraws-1);
+  }
+
+  // Kolmogorov distribution Q(lambda) = P(D > lambda)
+  double kolmogorov(double lambda)
+  {
+    // the series converges slowly but Q is 1 to machine precision
+    if(lambda<.2) return 1;
+
+    double q = 0, sign = 1;
+    for(int j=1; j<=100; ++j, sign=-sign)
+      q += 2*sign*exp(-2*j*j*lambda*lambda);
+    return max(0., min(1., q));
+  }
+
+  // p-value of the two-sample KS test (samples must be sorted)
+  double ks_two_samples(const vector<double>& a, const vector<double>& b)
+  {
+    double d = 0;
+    for(size_t i=0, j=0; i<a.size() and j<b.size();)
+    {
+      const double x = min(a[i], b[j]);
+      while(i<a.size() and a[i]<=x) ++i;
+      while(j<b.size() and b[j]<=x) ++j;
+      d = max(d, abs(double(i)/a.size() - double(j)/b.size()));
+    }
+
+    const double n = sqrt(double(a.size())*b.size()/(a.size()+b.size()));
+    return kolmogorov((n + .12 + .11/n)*d);
+  }
+
+  // p-value of the KS test against a centered gaussian (sorted sample)
+  double ks_gaussian(const vector<double>& a)
+  {
+    double var = 0;
+    for(const auto& x : a) var += x*x;
+    var /= a.size();
+
+    double d = 0;
+    for(size_t i=0; i<a.size(); ++i)
+    {
+      const double cdf = .5*erfc(-a[i]/sqrt(2*var));
+      d = max(d, max(abs(cdf - double(i)/a.size()),
+                     abs(cdf - double(i+1)/a.size())));
+    }
+
+    const double n = sqrt(double(a.size()));
+    return kolmogorov((n + .12 + .11/n)*d);
+  }
+
+  // print a single line of the report (checks that are not enforced always
+  // pass)
+  bool report(const string& name, double ref, double val, bool ok,
+              bool enforced = true)
+  {
+    cout << " " << left << setw(20) << name << right
+         << setw(14) << setprecision(5) << ref
+         << setw(14) << setprecision(5) << val
+         << setw(6) << (not enforced ? "-" : ok ? "ok" : "FAIL") << endl;
+    return ok or not enforced;
+  }
+} // namespace
+
+bool validate(const parameters& params, int steps)
+{
+  // is the reference expected to be Maxwellian?
+  bool passive = true;
+  for(int a=0; a<params.ntypes; ++a)
+    for(int b=0; b<params.ntypes; ++b)
+      passive = passive and params.interaction(a, b)==0;
+
+  // all runs use the same setup, only the engine differs
+  const auto with_engine = [&](const string& name) {
+    auto p = params;
+    p.engine = name;
+    // (srd needs its thermostat with interactions)
+    p.thermostat = name=="srd" and (params.thermostat or not passive);
+    return p;
+  };
+
+  bool success = true;
+
+  // the replicas and branches must not draw the same noise (the first step
+  // of the reference draws two numbers per particle)
+  {
+    const double shared = shared_noise(min<int64_t>(2*params.ntot(), 1<<18));
+    cout << endl << "random streams" << endl
+         << " " << left << setw(20) << "check" << right
+         << setw(14) << "expected" << setw(14) << "measured" << endl;
+    success &= report("shared noise", 0, shared, shared<shared_threshold);
+  }
+
+  // the tiled time steps against rebuilding the boxes, on four tiles and a
+  // shorter one, with a time step such that the fastest particles stay
+  // within the short tile or cross it (when the steps can not be tiled)
+  {
+    auto p = with_engine("reference");
+    p.L[0] = numeric_limits<int>::max();
+    const int rows = grid::tile_height(p), last = max(1, rows/4);
+    p.L[0] = 4*rows + last;
+
+    cout << endl << "tiled steps (" << p.L[0] << "x" << p.L[1] << ", tiles of "
+         << rows << " and " << last << " rows)" << endl
+         << " " << left << setw(20) << "check" << right
+         << setw(14) << "rebuild" << setw(14) << "tiled" << endl;
+    for(const bool crossing : { false, true })
+    {
+      p.tau = (crossing ? .5f*(last + rows) : .5f*last)/typical_vmax;
+      tiling rebuilt, tiled;
+      measure_tiling(p, min(steps, tiling_steps), true, rebuilt);
+      measure_tiling(p, min(steps, tiling_steps), false, tiled);
+
+      const string name = crossing ? "crossing" : "within";
+      success &= report(inline_str("particles (", name, ")"),
+                        rebuilt.count_drift, tiled.count_drift,
+                        rebuilt.count_drift==0 and tiled.count_drift==0);
+      const double p_ks = ks_two_samples(rebuilt.velocities, tiled.velocities);
+      success &= report(inline_str("KS p (", name, ")"), 1, p_ks,
+                        p_ks>ks_threshold);
+    }
+  }
+
+  // all engines on the same streams
+  map<string, measurement> runs;
+  for(const auto& name : engine_names())
+  {
+    auto& m = runs[name];
+    for(int s=0; s<transport_samples; ++s)
+    {
+      measure_equilibrium(with_engine(name), steps, s, m);
+      measure_viscosity(with_engine(name), steps, s, m);
+    }
+  }
+  const measurement& ref = runs["reference"];
+
+  // statistical error of the difference of the transport coefficients of two
+  // engines, from the spread of the runs of all engines with the reference
+  // operator
+  double diffusion_var = 0, viscosity_var = 0;
+  int same_operator = 0;
+  for(const auto& r : runs)
+    if(reference_operator(r.first))
+    {
+      diffusion_var += variance(r.second.diffusion);
+      viscosity_var += variance(r.second.viscosity);
+      ++same_operator;
+    }
+  const double diffusion_error
+    = sqrt(2*diffusion_var/same_operator/transport_samples);
+  const double viscosity_error
+    = sqrt(2*viscosity_var/same_operator/transport_samples);
+
+  for(const auto& name : engine_names())
+  {
+    const measurement& m = runs[name];
+
+    cout << endl << "engine " << name << " (" << steps << " steps, "
+         << transport_samples << " runs)" << endl
+         << " " << left << setw(20) << "check" << right
+         << setw(14) << "reference" << setw(14) << name << endl;
+
+    // exact conservation of the number of particles
+    for(int t=0; t<params.ntypes; ++t)
+      success &= report(inline_str("particles ", t),
+                        params.npart(t), m.counts_after[t],
+                        m.counts_before[t]==params.npart(t)
+                        and m.counts_after[t]==params.npart(t));
+
+    // momentum
+    success &= report("momentum drift", ref.momentum_drift, m.momentum_drift,
+                      m.momentum_drift<momentum_threshold);
+
+    // velocity distributions
+    const double p_gauss = ks_gaussian(m.velocities);
+    success &= report("KS p (maxwellian)", ks_gaussian(ref.velocities), p_gauss,
+                      not passive or p_gauss>ks_threshold);
+    // other collision operators share only the conservation laws
+    const bool same = reference_operator(name);
+    const double p_ref = ks_two_samples(ref.velocities, m.velocities);
+    success &= report("KS p (reference)", 1, p_ref, p_ref>ks_threshold, same);
+
+    // transport coefficients (mean over the runs)
+    const double D = mean(ref.diffusion), nu = mean(ref.viscosity);
+    const double D_tol = transport_sigmas*diffusion_error;
+    const double nu_tol = transport_sigmas*viscosity_error;
+    success &= report(inline_str("diffusion (", percent(D_tol/D), ")"),
+                      D, mean(m.diffusion), abs(mean(m.diffusion)-D)<D_tol,
+                      same);
+    success &= report(inline_str("viscosity (", percent(nu_tol/nu), ")"),
+                      nu, mean(m.viscosity), abs(mean(m.viscosity)-nu)<nu_tol,
+                      same);
+  }
+
+  cout << endl << (success ? "all checks passed" : "some checks FAILED") << endl;
+
+  return success;
+}
@@ -0,0 +1,31 @@
+// validate.hpp
+// statistical equivalence of the collision engines
+
+#ifndef VALIDATE_HPP_
+#define VALIDATE_HPP_
+
+#include "parameters.hpp"
+
+/** Compare all collision engines against the reference implementation
+ *
+ * Every engine is run for the given number of steps on the same setup (same
+ * parameters, same random stream) as the reference and checked for:
+ *
+ *  - exact conservation of the number of particles of each type,
+ *  - conservation of the total momentum (up to float round-off),
+ *  - the distribution of the velocities (two-sample Kolmogorov-Smirnov test
+ *    against the reference, and against a Maxwellian if kappa=0),
+ *  - the self-diffusion constant (from the mean square displacement),
+ *  - the kinematic viscosity (from the decay of a transverse shear wave).
+ *
+ * The random streams of the replicas and branches are also checked to share
+ * (almost) none of the noise of their first step, and the time steps done
+ * tile by tile (see grid::step) to conserve the particles and to give the
+ * same velocities as rebuilding the boxes, on a grid whose last tile is
+ * shorter than the others.
+ *
+ * Prints a report and returns true if all checks passed.
+ * */
+bool validate(const parameters& params, int steps);
+
+#endif//VALIDATE_HPP_
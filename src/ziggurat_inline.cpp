@@ -10,17 +10,20 @@ using namespace std;
 
 static float fe[256];
 static float fn[128];
-static int32_t hz;
-static uint32_t iz;
-static uint32_t jcong = 234567891;
-static uint32_t jsr = 123456789;
-static uint32_t jz;
+//
+//  The state of the generators is per thread, the tables are shared.
+//
+static thread_local int32_t hz;
+static thread_local uint32_t iz;
+static thread_local uint32_t jcong = 234567891;
+static thread_local uint32_t jsr = 123456789;
+static thread_local uint32_t jz;
 static uint32_t ke[256];
 static uint32_t kn[128];
-static uint32_t w = 345678912;
+static thread_local uint32_t w = 345678912;
 static float we[256];
 static float wn[128];
-static uint32_t z = 456789123;
+static thread_local uint32_t z = 456789123;
 //
 //  The original SHR3 random number generator was replaced by
 //  KISS, a combination of MWC, CONG and SHR3 as suggested in
@@ -478,8 +481,8 @@ float nfix ( )
 //
 {
   const float r = 3.442620;
-  static float x;
-  static float y;
+  static thread_local float x;
+  static thread_local float y;
 
   for ( ; ; )
   {
@@ -1084,3 +1087,51 @@ void zigset ( uint32_t jsr_value, uint32_t jcong_value, uint32_t w_value,
 
   return;
 }
+//****************************************************************************80
+
+void zigseed ( uint32_t jsr_value, uint32_t jcong_value, uint32_t w_value,
+  uint32_t z_value )
+
+//****************************************************************************80
+//
+//  Purpose:
+//
+//    ZIGSEED sets the seeds of the calling thread only.
+//
+//  Discussion:
+//
+//    The tables must have been created by ZIGSET before.
+//
+{
+  jsr = jsr_value;
+  jcong = jcong_value;
+  w = w_value;
+  z = z_value;
+
+  return;
+}
+//****************************************************************************80
+
+void r4_fill ( float normal[], float uniform[], int n )
+
+//****************************************************************************80
+//
+//  Purpose:
+//
+//    R4_FILL fills tables of normal and uniform values.
+//
+//  Discussion:
+//
+//    Same values as N alternate calls to R4_NOR_VALUE and R4_UNI_VALUE.
+//    Each value depends on the state left by the previous one, such that
+//    the loop can not be vectorized.
+//
+{
+  for ( int i = 0; i < n; i++ )
+  {
+    normal[i] = r4_nor_value ( );
+    uniform[i] = r4_uni_value ( );
+  }
+
+  return;
+}
@@ -12,6 +12,7 @@ float r4_exp_value ( );
 void r4_nor_setup ( );
 float r4_nor_value ( );
 float r4_uni_value ( );
+void r4_fill ( float normal[], float uniform[], int n );
 uint32_t shr3_seeded ( uint32_t &jsr );
 uint32_t shr3_value ( );
 void timestamp ( );
@@ -19,4 +20,6 @@ void zigget ( uint32_t &jsr_value, uint32_t &jcong_value,
   uint32_t &w_value, uint32_t &z_value );
 void zigset ( uint32_t jsr_value, uint32_t jcong_value,
   uint32_t w_value, uint32_t z_value );
+void zigseed ( uint32_t jsr_value, uint32_t jcong_value,
+  uint32_t w_value, uint32_t z_value );
 